@@ -0,0 +1,395 @@
+#include <math.h>
+#include <string.h>
+
+#include "util.h"
+#include "sparsemat.h"
+#include "cholesky.h"
+
+#define AMG_MAX_LEVELS 24
+//levels at or below this many rows are solved directly
+#define AMG_COARSE 400
+//a_ij is a strong connection when |a_ij| >= theta sqrt(|a_ii a_jj|), theta halving every level down
+//since galerkin operators spread the same coupling over more and more neighbours
+#define AMG_THETA 0.08
+
+typedef struct {
+	const csr_t* a; //level 0 is the caller's matrix, coarser ones point at own
+	csr_t own;
+	csr_t p; //prolongation from the next level to this one
+	csr_t r; //p^T
+
+	unsigned* diag; //position of each row's diagonal in a
+	double* x;
+	double* b;
+	double* res;
+} amg_level_t;
+
+//smoothed aggregation multigrid for spd systems from scalar poisson like operators
+//the hierarchy is built once in amg_new, after that every v-cycle only does smoothing and matrix vector products
+typedef struct {
+	amg_level_t levels[AMG_MAX_LEVELS];
+	unsigned nlevels;
+
+	unsigned sweeps; //gauss-seidel sweeps before and after each coarse correction
+	chol_t coarse; //direct solve on the coarsest level
+	int coarse_ok; //0 if the coarsest operator was singular, it is smoothed instead
+	int ok; //0 if some row of a level has no diagonal entry, the hierarchy is then empty
+
+	unsigned iters; //of the last amg_solve
+	double residual; //relative, of the last amg_solve
+} amg_t;
+
+//groups of strongly connected nodes become single coarse nodes (vanek, mandel, brezina)
+//1: whole untouched neighbourhoods, 2: leftovers join an aggregate from step 1 next to them,
+//3: what remains forms aggregates with its free neighbours. rows with nothing off the diagonal stay out (-1),
+//the smoother solves them exactly
+static unsigned amg_aggregate(const csr_t* a, const unsigned* diag, double theta, unsigned* agg) {
+	unsigned n = a->nrows;
+	unsigned* strong = heap(sizeof(unsigned)*(a->nnz ? a->nnz : 1)); //1 per strong entry of a
+	unsigned* join = heap(sizeof(unsigned)*(n ? n : 1));
+
+	for (unsigned r=0; r<n; r++) {
+		double ar = fabs(a->val[diag[r]]);
+		agg[r] = (unsigned)-2; //isolated until a neighbour shows up
+
+		for (unsigned i=a->row_ptr[r]; i<a->row_ptr[r+1]; i++) {
+			unsigned c = a->col[i];
+			strong[i] = c != r && fabs(a->val[i]) >= theta*sqrt(ar*fabs(a->val[diag[c]]));
+			if (c != r && a->val[i] != 0) agg[r] = (unsigned)-1;
+		}
+	}
+
+	unsigned nagg = 0;
+	for (unsigned r=0; r<n; r++) {
+		if (agg[r] != (unsigned)-1) continue;
+
+		int free = 1;
+		for (unsigned i=a->row_ptr[r]; i<a->row_ptr[r+1] && free; i++) {
+			if (strong[i] && agg[a->col[i]] != (unsigned)-1) free = 0;
+		}
+
+		if (!free) continue;
+
+		agg[r] = nagg;
+		for (unsigned i=a->row_ptr[r]; i<a->row_ptr[r+1]; i++) {
+			if (strong[i]) agg[a->col[i]] = nagg;
+		}
+
+		nagg++;
+	}
+
+	//read from the step 1 result only, so aggregates do not creep along chains of leftovers
+	//rows with only weak couplings go with their largest one, they would be singletons otherwise
+	for (unsigned r=0; r<n; r++) {
+		join[r] = agg[r];
+		if (agg[r] != (unsigned)-1) continue;
+
+		double weak = 0;
+		for (unsigned i=a->row_ptr[r]; i<a->row_ptr[r+1]; i++) {
+			unsigned g = agg[a->col[i]];
+			if (g >= nagg) continue;
+
+			if (strong[i]) {
+				join[r] = g;
+				break;
+			}
+
+			if (a->col[i] != r && fabs(a->val[i]) > weak) {
+				weak = fabs(a->val[i]);
+				join[r] = g;
+			}
+		}
+	}
+
+	memcpy(agg, join, sizeof(unsigned)*n);
+
+	for (unsigned r=0; r<n; r++) {
+		if (agg[r] != (unsigned)-1) continue;
+
+		agg[r] = nagg;
+		for (unsigned i=a->row_ptr[r]; i<a->row_ptr[r+1]; i++) {
+			if (strong[i] && agg[a->col[i]] == (unsigned)-1) agg[a->col[i]] = nagg;
+		}
+
+		nagg++;
+	}
+
+	for (unsigned r=0; r<n; r++) if (agg[r] == (unsigned)-2) agg[r] = (unsigned)-1;
+
+	drop(strong);
+	drop(join);
+	return nagg;
+}
+
+//largest eigenvalue of d^-1 a by power iteration, a few steps are plenty for the damping factor
+static double amg_rho(const csr_t* a, const unsigned* diag) {
+	unsigned n = a->nrows;
+	double* x = heap(sizeof(double)*(n ? n : 1));
+	double* y = heap(sizeof(double)*(n ? n : 1));
+
+	unsigned long long seed = 88172645463325252ull;
+	for (unsigned i=0; i<n; i++) {
+		seed ^= seed<<13; seed ^= seed>>7; seed ^= seed<<17;
+		x[i] = (double)(seed%1024)/1024.0 - 0.5;
+	}
+
+	double rho = 0;
+	for (unsigned it=0; it<15; it++) {
+		double nx = 0, ny = 0;
+		csr_spmv(a, x, y);
+		for (unsigned i=0; i<n; i++) {
+			y[i] /= a->val[diag[i]];
+			nx += x[i]*x[i];
+			ny += y[i]*y[i];
+		}
+
+		if (nx == 0 || ny == 0) break;
+		rho = sqrt(ny/nx);
+
+		double inv = 1.0/sqrt(ny);
+		for (unsigned i=0; i<n; i++) x[i] = y[i]*inv;
+	}
+
+	drop(x);
+	drop(y);
+	return rho;
+}
+
+//p = (I - omega d^-1 a) t, t the piecewise constant tentative prolongator with unit columns
+static csr_t amg_prolongator(const csr_t* a, const unsigned* diag, const unsigned* agg, unsigned nagg) {
+	unsigned n = a->nrows;
+	csr_t t = {.nrows=n, .ncols=nagg};
+	t.row_ptr = heap(sizeof(unsigned)*(n+1));
+	t.col = heap(sizeof(unsigned)*(n ? n : 1));
+	t.val = heap(sizeof(double)*(n ? n : 1));
+
+	unsigned* size = heap(sizeof(unsigned)*(nagg ? nagg : 1));
+	memset(size, 0, sizeof(unsigned)*nagg);
+	for (unsigned r=0; r<n; r++) if (agg[r] != (unsigned)-1) size[agg[r]]++;
+
+	t.row_ptr[0] = 0;
+	for (unsigned r=0; r<n; r++) {
+		t.row_ptr[r+1] = t.row_ptr[r];
+		if (agg[r] == (unsigned)-1) continue;
+
+		t.col[t.nnz] = agg[r];
+		t.val[t.nnz++] = 1.0/sqrt((double)size[agg[r]]);
+		t.row_ptr[r+1]++;
+	}
+
+	//a zero level or a power iteration that collapsed leaves nothing to damp by, t is kept unsmoothed
+	double rho = amg_rho(a, diag);
+	if (!(rho > 0 && rho < INFINITY)) {
+		drop(size);
+		return t;
+	}
+
+	double omega = 4.0/3.0/rho;
+	csr_t p = csr_matmul(a, &t);
+
+	for (unsigned r=0; r<n; r++) {
+		double scale = -omega/a->val[diag[r]];
+		for (unsigned i=p.row_ptr[r]; i<p.row_ptr[r+1]; i++) {
+			p.val[i] *= scale;
+			if (agg[r] != (unsigned)-1 && p.col[i] == agg[r]) p.val[i] += t.val[t.row_ptr[r]];
+		}
+	}
+
+	csr_free(&t);
+	drop(size);
+	return p;
+}
+
+//0 if a row has no diagonal entry to smooth with
+static int amg_level_alloc(amg_level_t* l) {
+	unsigned n = l->a->nrows ? l->a->nrows : 1;
+	l->diag = csr_diag(l->a);
+	if (!l->diag) return 0;
+
+	l->x = heap(sizeof(double)*n);
+	l->b = heap(sizeof(double)*n);
+	l->res = heap(sizeof(double)*n);
+	return 1;
+}
+
+//a_c = r a p into the next level's own operator
+static void amg_coarsen(amg_level_t* fine, amg_level_t* coarse) {
+	csr_t ap = csr_matmul(fine->a, &fine->p);
+	csr_free(&coarse->own);
+	coarse->own = csr_matmul(&fine->r, &ap);
+	coarse->a = &coarse->own;
+	csr_free(&ap);
+}
+
+static void amg_factor_coarse(amg_t* amg) {
+	amg_level_t* last = &amg->levels[amg->nlevels-1];
+	chol_free(&amg->coarse);
+	amg->coarse = chol_new(last->a, chol_llt, chol_nd);
+	amg->coarse_ok = chol_factor(&amg->coarse, last->a);
+}
+
+void amg_free(amg_t* amg) {
+	for (unsigned i=0; i<amg->nlevels; i++) {
+		amg_level_t* l = &amg->levels[i];
+		csr_free(&l->own);
+		csr_free(&l->p);
+		csr_free(&l->r);
+		drop(l->diag);
+		drop(l->x);
+		drop(l->b);
+		drop(l->res);
+	}
+
+	chol_free(&amg->coarse);
+}
+
+//a has to stay alive and unchanged while the hierarchy is used. check ok, a row without a diagonal entry
+//leaves nothing to smooth with and the hierarchy empty
+amg_t amg_new(const csr_t* a) {
+	amg_t amg = {.sweeps=1, .ok=1};
+	amg.levels[0].a = a;
+	amg.nlevels = 1;
+	if (!amg_level_alloc(&amg.levels[0])) {
+		amg_free(&amg);
+		return (amg_t){0};
+	}
+
+	unsigned* agg = heap(sizeof(unsigned)*(a->nrows ? a->nrows : 1));
+
+	while (amg.nlevels < AMG_MAX_LEVELS) {
+		amg_level_t* fine = &amg.levels[amg.nlevels-1];
+		unsigned n = fine->a->nrows;
+		if (n <= AMG_COARSE) break;
+
+		unsigned nagg = amg_aggregate(fine->a, fine->diag, AMG_THETA*ldexp(1.0, -(int)amg.nlevels+1), agg);
+		//coarsening stalled, another level would cost as much as this one
+		if (nagg == 0 || nagg > n - n/8) break;
+
+		fine->p = amg_prolongator(fine->a, fine->diag, agg, nagg);
+		fine->r = csr_transpose(&fine->p);
+
+		amg_level_t* coarse = &amg.levels[amg.nlevels++];
+		amg_coarsen(fine, coarse);
+		if (!amg_level_alloc(coarse)) {
+			drop(agg);
+			amg_free(&amg);
+			return (amg_t){0};
+		}
+	}
+
+	drop(agg);
+	amg_factor_coarse(&amg);
+	return amg;
+}
+
+//new values on the pattern the hierarchy was built from: aggregates and prolongators are kept,
+//only the coarse operators and the coarse factorization are redone
+void amg_refresh(amg_t* amg, const csr_t* a) {
+	if (!amg->ok) return;
+
+	amg->levels[0].a = a;
+	drop(amg->levels[0].diag);
+	amg->levels[0].diag = csr_diag(a);
+
+	for (unsigned l=0; l+1<amg->nlevels; l++) {
+		amg_coarsen(&amg->levels[l], &amg->levels[l+1]);
+		drop(amg->levels[l+1].diag);
+		amg->levels[l+1].diag = csr_diag(amg->levels[l+1].a);
+	}
+
+	amg_factor_coarse(amg);
+}
+
+static void amg_sweep(const amg_level_t* l, const double* b, double* x, int backward) {
+	const csr_t* a = l->a;
+	unsigned n = a->nrows;
+
+	for (unsigned k=0; k<n; k++) {
+		unsigned r = backward ? n-1-k : k;
+		double sum = b[r];
+		for (unsigned i=a->row_ptr[r]; i<a->row_ptr[r+1]; i++) sum -= a->val[i]*x[a->col[i]];
+		x[r] += sum/a->val[l->diag[r]];
+	}
+}
+
+//forward sweeps on the way down and backward ones on the way up keep the cycle symmetric for cg
+static void amg_cycle(amg_t* amg, unsigned lvl) {
+	amg_level_t* l = &amg->levels[lvl];
+	unsigned n = l->a->nrows;
+	memset(l->x, 0, sizeof(double)*n);
+
+	if (lvl == amg->nlevels-1) {
+		if (amg->coarse_ok) {
+			chol_solve(&amg->coarse, l->b, l->x, 1);
+		} else {
+			for (unsigned s=0; s<8; s++) {
+				amg_sweep(l, l->b, l->x, 0);
+				amg_sweep(l, l->b, l->x, 1);
+			}
+		}
+
+		return;
+	}
+
+	for (unsigned s=0; s<amg->sweeps; s++) amg_sweep(l, l->b, l->x, 0);
+
+	csr_spmv(l->a, l->x, l->res);
+	for (unsigned i=0; i<n; i++) l->res[i] = l->b[i] - l->res[i];
+
+	amg_level_t* c = &amg->levels[lvl+1];
+	csr_spmv(&l->r, l->res, c->b);
+	amg_cycle(amg, lvl+1);
+
+	csr_spmv(&l->p, c->x, l->res);
+	for (unsigned i=0; i<n; i++) l->x[i] += l->res[i];
+
+	for (unsigned s=0; s<amg->sweeps; s++) amg_sweep(l, l->b, l->x, 1);
+}
+
+//z = one v-cycle on r from a zero guess, an spd approximation of a^-1 r. z and r may not alias
+void amg_vcycle(amg_t* amg, const double* r, double* z) {
+	amg_level_t* l = &amg->levels[0];
+	unsigned n = l->a->nrows;
+
+	memcpy(l->b, r, sizeof(double)*n);
+	amg_cycle(amg, 0);
+	memcpy(z, l->x, sizeof(double)*n);
+}
+
+//v-cycles as a stationary solver, x holds the initial guess. 1 once ||b - a x||/||b|| <= tol
+int amg_solve(amg_t* amg, const double* b, double* x, double tol, unsigned max_iter) {
+	amg->iters = 0;
+	if (!amg->ok) return 0;
+
+	amg_level_t* l = &amg->levels[0];
+	const csr_t* a = l->a;
+	unsigned n = a->nrows;
+
+	double bnorm = 0;
+	for (unsigned i=0; i<n; i++) bnorm += b[i]*b[i];
+	bnorm = sqrt(bnorm);
+
+	if (bnorm == 0) {
+		memset(x, 0, sizeof(double)*n);
+		amg->residual = 0;
+		return 1;
+	}
+
+	for (;;) {
+		csr_spmv(a, x, l->b);
+
+		double rnorm = 0;
+		for (unsigned i=0; i<n; i++) {
+			l->b[i] = b[i] - l->b[i];
+			rnorm += l->b[i]*l->b[i];
+		}
+
+		amg->residual = sqrt(rnorm)/bnorm;
+		if (amg->residual <= tol) return 1;
+		if (amg->iters == max_iter) return 0;
+
+		amg_cycle(amg, 0);
+		for (unsigned i=0; i<n; i++) x[i] += l->x[i];
+		amg->iters++;
+	}
+}
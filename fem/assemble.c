@@ -0,0 +1,289 @@
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "util.h"
+#include "sparsemat.h"
+#include "pool.h"
+#include "mesh.h"
+
+//fills the element matrix ke (npe*npe, row major) and load fe (npe) of one element, both zeroed beforehand
+//called concurrently for elements of one color, so it may only write ke and fe
+typedef void (*assembly_fn)(void* arg, unsigned elem, const unsigned* nodes, double* ke, double* fe);
+
+//parallel element assembly onto a fixed pattern. the pattern, the position of every element entry in it
+//and a coloring of the elements are worked out once, after that each assembly_run only computes and adds.
+//elements of one color share no node, so within a color threads never write the same row, and every entry
+//sums its contributions in color order whatever the thread count: the result is bit for bit the serial one
+typedef struct {
+	unsigned nnodes, nelems;
+	unsigned npe; //nodes per element
+	const unsigned* nodes; //nelems*npe, the caller's
+	pool_t* pool;
+
+	//none of these for assembly_matfree_new
+	csr_t a; //pattern, values of the last assembly_run
+	double* b; //load vector of the last assembly_run
+	unsigned* map; //nelems*npe*npe positions in a.val, row major like ke
+
+	unsigned ncolors;
+	unsigned* color_ptr; //ncolors+1, into order
+	unsigned* order; //elements by color, increasing within each
+
+	double* scratch; //per worker ke and fe
+} assembly_t;
+
+static void assembly_map(void* arg, unsigned worker, unsigned begin, unsigned end) {
+	assembly_t* as = arg;
+	unsigned npe = as->npe;
+
+	for (unsigned e=begin; e<end; e++) {
+		const unsigned* nd = as->nodes + (size_t)e*npe;
+		unsigned* m = as->map + (size_t)e*npe*npe;
+
+		for (unsigned i=0; i<npe; i++) {
+			const unsigned* col = as->a.col;
+			unsigned lo = as->a.row_ptr[nd[i]], hi = as->a.row_ptr[nd[i]+1];
+
+			for (unsigned j=0; j<npe; j++) {
+				unsigned l = lo, h = hi;
+				while (l < h) {
+					unsigned mid = (l + h)/2;
+					if (col[mid] < nd[j]) l = mid+1;
+					else h = mid;
+				}
+
+				m[i*npe + j] = l;
+			}
+		}
+	}
+}
+
+//greedy in element order, lowest color none of the element's nodes has seen yet. node masks cover 64 colors
+//at a time, elements that find all 64 taken wait for a fresh window
+static void assembly_color(assembly_t* as) {
+	unsigned npe = as->npe;
+	uint64_t* seen = heap(sizeof(uint64_t)*(as->nnodes ? as->nnodes : 1));
+	unsigned* color = heap(sizeof(unsigned)*(as->nelems ? as->nelems : 1));
+	memset(color, 0xff, sizeof(unsigned)*as->nelems);
+
+	unsigned left = as->nelems;
+	for (unsigned base=0; left; base+=64) {
+		memset(seen, 0, sizeof(uint64_t)*as->nnodes);
+
+		for (unsigned e=0; e<as->nelems; e++) {
+			if (color[e] != (unsigned)-1) continue;
+
+			const unsigned* nd = as->nodes + (size_t)e*npe;
+			uint64_t used = 0;
+			for (unsigned i=0; i<npe; i++) used |= seen[nd[i]];
+			if (used == ~(uint64_t)0) continue;
+
+			unsigned c = (unsigned)__builtin_ctzll(~used);
+			color[e] = base + c;
+			for (unsigned i=0; i<npe; i++) seen[nd[i]] |= (uint64_t)1<<c;
+
+			if (base + c + 1 > as->ncolors) as->ncolors = base + c + 1;
+			left--;
+		}
+	}
+
+	//counting sort by color, stable so each color keeps element order
+	as->color_ptr = heap(sizeof(unsigned)*(as->ncolors+1));
+	memset(as->color_ptr, 0, sizeof(unsigned)*(as->ncolors+1));
+	for (unsigned e=0; e<as->nelems; e++) as->color_ptr[color[e]+1]++;
+	for (unsigned c=0; c<as->ncolors; c++) as->color_ptr[c+1] += as->color_ptr[c];
+
+	unsigned* fill = heapcpy(sizeof(unsigned)*(as->ncolors ? as->ncolors : 1), as->color_ptr);
+	as->order = heap(sizeof(unsigned)*(as->nelems ? as->nelems : 1));
+	for (unsigned e=0; e<as->nelems; e++) as->order[fill[color[e]]++] = e;
+
+	drop(fill);
+	drop(seen);
+	drop(color);
+}
+
+//the coloring and the worker scratch, all the matrix free operator needs
+static assembly_t assembly_base(unsigned nnodes, const unsigned* nodes, unsigned nelems, unsigned npe, pool_t* pool) {
+	assembly_t as = {.nnodes=nnodes, .nelems=nelems, .npe=npe, .nodes=nodes, .pool=pool};
+	assembly_color(&as);
+	as.scratch = heap(sizeof(double)*npe*(npe+1)*pool_threads(pool));
+	return as;
+}
+
+//nodes holds npe node indices per element and has to outlive the assembly
+assembly_t assembly_new(unsigned nnodes, const unsigned* nodes, unsigned nelems, unsigned npe, pool_t* pool) {
+	assembly_t as = assembly_base(nnodes, nodes, nelems, npe, pool);
+
+	sparsemat_t m = sparsemat_new(nnodes, nnodes);
+	for (unsigned e=0; e<nelems; e++) {
+		const unsigned* nd = nodes + (size_t)e*npe;
+		for (unsigned i=0; i<npe; i++) {
+			for (unsigned j=0; j<npe; j++) sparsemat_push(&m, nd[i], nd[j], 0);
+		}
+	}
+
+	as.a = sparsemat_freeze(&m);
+	sparsemat_free(&m);
+
+	as.map = heap(sizeof(unsigned)*(nelems ? (size_t)nelems*npe*npe : 1));
+	pool_run(pool, assembly_map, &as, nelems, pool_grain(pool, nelems));
+
+	as.b = heap(sizeof(double)*(nnodes ? nnodes : 1));
+	return as;
+}
+
+//no pattern, map or load vector, only the coloring: assembly_apply and assembly_diag recompute elements on the fly
+//for about 4 bytes per element on top of the connectivity, against 12 per matrix entry for csr
+assembly_t assembly_matfree_new(unsigned nnodes, const unsigned* nodes, unsigned nelems, unsigned npe, pool_t* pool) {
+	return assembly_base(nnodes, nodes, nelems, npe, pool);
+}
+
+typedef struct {
+	assembly_t* as;
+	assembly_fn fn;
+	void* arg;
+	const unsigned* elems; //of the current color
+
+	const double* x; //apply
+	double* y; //apply: K x, diag: the diagonal
+} assembly_job_t;
+
+//ke and fe of element e in the worker's scratch
+static double* assembly_elem(assembly_job_t* job, unsigned worker, unsigned e) {
+	assembly_t* as = job->as;
+	unsigned npe = as->npe;
+
+	double* ke = as->scratch + (size_t)worker*npe*(npe+1);
+	memset(ke, 0, sizeof(double)*npe*(npe+1));
+	job->fn(job->arg, e, as->nodes + (size_t)e*npe, ke, ke + npe*npe);
+	return ke;
+}
+
+static void assembly_part_run(void* arg, unsigned worker, unsigned begin, unsigned end) {
+	assembly_job_t* job = arg;
+	assembly_t* as = job->as;
+	unsigned npe = as->npe, nk = npe*npe;
+
+	for (unsigned k=begin; k<end; k++) {
+		unsigned e = job->elems[k];
+		const unsigned* nd = as->nodes + (size_t)e*npe;
+		const unsigned* m = as->map + (size_t)e*nk;
+		double* ke = assembly_elem(job, worker, e);
+
+		for (unsigned i=0; i<nk; i++) as->a.val[m[i]] += ke[i];
+		for (unsigned i=0; i<npe; i++) as->b[nd[i]] += ke[nk + i];
+	}
+}
+
+static void assembly_part_apply(void* arg, unsigned worker, unsigned begin, unsigned end) {
+	assembly_job_t* job = arg;
+	unsigned npe = job->as->npe;
+
+	for (unsigned k=begin; k<end; k++) {
+		unsigned e = job->elems[k];
+		const unsigned* nd = job->as->nodes + (size_t)e*npe;
+		double* ke = assembly_elem(job, worker, e);
+
+		for (unsigned i=0; i<npe; i++) {
+			double sum = 0;
+			for (unsigned j=0; j<npe; j++) sum += ke[i*npe + j]*job->x[nd[j]];
+			job->y[nd[i]] += sum;
+		}
+	}
+}
+
+static void assembly_part_diag(void* arg, unsigned worker, unsigned begin, unsigned end) {
+	assembly_job_t* job = arg;
+	unsigned npe = job->as->npe;
+
+	for (unsigned k=begin; k<end; k++) {
+		unsigned e = job->elems[k];
+		const unsigned* nd = job->as->nodes + (size_t)e*npe;
+		double* ke = assembly_elem(job, worker, e);
+		for (unsigned i=0; i<npe; i++) job->y[nd[i]] += ke[i*npe + i];
+	}
+}
+
+//one pool_run per color
+static void assembly_sweep(assembly_t* as, pool_fn part, assembly_job_t* job) {
+	for (unsigned c=0; c<as->ncolors; c++) {
+		unsigned cnt = as->color_ptr[c+1] - as->color_ptr[c];
+		job->elems = as->order + as->color_ptr[c];
+		pool_run(as->pool, part, job, cnt, pool_grain(as->pool, cnt));
+	}
+}
+
+//a and b from scratch
+void assembly_run(assembly_t* as, assembly_fn fn, void* arg) {
+	memset(as->a.val, 0, sizeof(double)*as->a.nnz);
+	memset(as->b, 0, sizeof(double)*as->nnodes);
+
+	assembly_job_t job = {.as=as, .fn=fn, .arg=arg};
+	assembly_sweep(as, assembly_part_run, &job);
+}
+
+//y = K x element by element without forming K, same color order and so the same bits for any thread count
+void assembly_apply(assembly_t* as, assembly_fn fn, void* arg, const double* x, double* y) {
+	memset(y, 0, sizeof(double)*as->nnodes);
+	assembly_job_t job = {.as=as, .fn=fn, .arg=arg, .x=x, .y=y};
+	assembly_sweep(as, assembly_part_apply, &job);
+}
+
+//diagonal of K, for jacobi through precond_diag_new
+void assembly_diag(assembly_t* as, assembly_fn fn, void* arg, double* diag) {
+	memset(diag, 0, sizeof(double)*as->nnodes);
+	assembly_job_t job = {.as=as, .fn=fn, .arg=arg, .y=diag};
+	assembly_sweep(as, assembly_part_diag, &job);
+}
+
+//an element kernel bound to its assembly, the arg of assembly_op_apply
+typedef struct {
+	assembly_t* as;
+	assembly_fn fn;
+	void* arg;
+} assembly_op_t;
+
+//matches krylov_apply_fn, so cg_new_op and friends can take the element loop as their operator
+void assembly_op_apply(void* arg, const double* x, double* y) {
+	assembly_op_t* op = arg;
+	assembly_apply(op->as, op->fn, op->arg, x, y);
+}
+
+//p1 laplacian on a triangle in 3d, arg the mesh_t of the nodes: ke_ij = e_i . e_j / 4A with e_i the edge
+//opposite node i, and a unit source lumped to A/3 per node. degenerate triangles contribute nothing
+void assembly_laplace_tri(void* arg, unsigned elem, const unsigned* nodes, double* ke, double* fe) {
+	const mesh_t* m = arg;
+	double e[3][3];
+
+	for (unsigned i=0; i<3; i++) {
+		unsigned a = nodes[(i+1)%3], b = nodes[(i+2)%3];
+		e[i][0] = (double)m->x[b] - (double)m->x[a];
+		e[i][1] = (double)m->y[b] - (double)m->y[a];
+		e[i][2] = (double)m->z[b] - (double)m->z[a];
+	}
+
+	double cx = e[0][1]*e[1][2] - e[0][2]*e[1][1];
+	double cy = e[0][2]*e[1][0] - e[0][0]*e[1][2];
+	double cz = e[0][0]*e[1][1] - e[0][1]*e[1][0];
+	double area = 0.5*sqrt(cx*cx + cy*cy + cz*cz);
+	if (area == 0) return;
+
+	double scale = 0.25/area;
+	for (unsigned i=0; i<3; i++) {
+		for (unsigned j=i; j<3; j++) {
+			ke[i*3 + j] = ke[j*3 + i] = (e[i][0]*e[j][0] + e[i][1]*e[j][1] + e[i][2]*e[j][2])*scale;
+		}
+
+		fe[i] = area/3;
+	}
+}
+
+void assembly_free(assembly_t* as) {
+	csr_free(&as->a);
+	drop(as->b);
+	drop(as->map);
+	drop(as->color_ptr);
+	drop(as->order);
+	drop(as->scratch);
+}
@@ -0,0 +1,1196 @@
+#include <complex.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "util.h"
+#include "hashtable.h"
+#include "fft.h"
+#include "rfft.h"
+#include "fft3.h"
+#include "fft_simd.h"
+#include "pool.h"
+#include "sparsemat.h"
+#include "spmv.h"
+#include "reorder.h"
+#include "cholesky.h"
+#include "precond.h"
+#include "krylov.h"
+#include "amg.h"
+#include "bsr.h"
+#include "assemble.h"
+#include "weld.h"
+#include "bvh.h"
+#include "mesh.h"
+#include "cpu.h"
+
+static double bench_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec*1e-9;
+}
+
+//the recursive transform fft_plan replaced, kept as a baseline. children are freed so it can loop
+static complex float* fft_recursive(float* v, int v_stride, complex float* coeffs, int res, int stride) {
+	complex float* fftres = heap(sizeof(complex float)*res);
+
+	if (res % 2 == 0) {
+		complex float* fft1 = fft_recursive(v, v_stride*2, coeffs, res/2, stride*2);
+		complex float* fft2 = fft_recursive(&v[v_stride], v_stride*2, coeffs, res/2, stride*2);
+
+		for (int i=0; i<res; i++) {
+			fftres[i] = fft1[i%(res/2)] + fft2[i%(res/2)]*coeffs[stride*(i%res)];
+		}
+
+		drop(fft1);
+		drop(fft2);
+	} else {
+		memset(fftres, 0, sizeof(complex float)*res);
+
+		for (unsigned i=0; i<res; i++) {
+			for (unsigned vi=0; vi<res; vi++) {
+				fftres[i] += (v[vi*v_stride] * (1+i)) * coeffs[stride*((i*vi) % res)];
+			}
+		}
+	}
+
+	return fftres;
+}
+
+//enough repetitions that each size runs for roughly the same time
+static unsigned bench_reps(unsigned n) {
+	unsigned reps = (1u<<24)/n;
+	return reps > 1 ? reps/8 + 1 : 1;
+}
+
+void bench_fft() {
+	printf("%8s %14s %14s %10s %8s\n", "n", "recursive ns", "plan ns", "mflops", "speedup");
+
+	for (unsigned lg=4; lg<=20; lg++) {
+		unsigned n = 1u<<lg;
+		unsigned reps = bench_reps(n);
+
+		float* v = heap(sizeof(float)*n);
+		complex float* x = heap(sizeof(complex float)*n);
+		for (unsigned i=0; i<n; i++) v[i] = (float)(i%17) - 8.0f;
+
+		fft_twiddle_t coeffs = fft_coeffs(n);
+		double start = bench_now();
+		for (unsigned r=0; r<reps; r++) drop(fft_recursive(v, 1, (complex float*)coeffs.w, n, coeffs.stride));
+		double t_rec = (bench_now() - start)/reps;
+
+		fft_plan_t plan = fft_plan(n);
+		for (unsigned i=0; i<n; i++) x[i] = v[i];
+
+		start = bench_now();
+		for (unsigned r=0; r<reps; r++) fft_exec(&plan, x, r%2 ? fft_inverse : fft_forward);
+		double t_plan = (bench_now() - start)/reps;
+		fft_plan_free(&plan);
+
+		printf("%8u %14.0f %14.0f %10.1f %8.1f\n", n, t_rec*1e9, t_plan*1e9, 5.0*n*lg/t_plan*1e-6, t_rec/t_plan);
+
+		drop(v);
+		drop(x);
+	}
+
+	//non power of two lengths: smooth sizes go mixed radix, 3*2^k+1 is usually bluestein
+	static const char* kinds[] = {[fft_pow2]="pow2", [fft_mixed]="mixed", [fft_bluestein]="bluestein"};
+	printf("\n%8s %10s %14s %10s\n", "n", "kind", "plan ns", "mflops");
+
+	for (unsigned lg=4; lg<=18; lg+=2) {
+		unsigned sizes[] = {3u<<lg, 5u<<lg, 7u<<lg, (3u<<lg) + 1};
+
+		for (unsigned i=0; i<4; i++) {
+			unsigned n = sizes[i];
+			unsigned reps = bench_reps(n);
+
+			complex float* x = heap(sizeof(complex float)*n);
+			for (unsigned j=0; j<n; j++) x[j] = (float)(j%17) - 8.0f;
+
+			fft_plan_t plan = fft_plan(n);
+			double start = bench_now();
+			for (unsigned r=0; r<reps; r++) fft_exec(&plan, x, r%2 ? fft_inverse : fft_forward);
+			double t_plan = (bench_now() - start)/reps;
+
+			printf("%8u %10s %14.0f %10.1f\n", n, kinds[plan.kind], t_plan*1e9, 5.0*n*log2(n)/t_plan*1e-6);
+
+			fft_plan_free(&plan);
+			drop(x);
+		}
+	}
+
+	//real input through a complex plan vs the r2c plan
+	printf("\n%8s %14s %14s %8s\n", "n", "complex ns", "r2c ns", "speedup");
+
+	for (unsigned lg=4; lg<=20; lg+=2) {
+		unsigned n = 1u<<lg;
+		unsigned reps = bench_reps(n);
+
+		float* v = heap(sizeof(float)*n);
+		complex float* x = heap(sizeof(complex float)*n);
+		for (unsigned i=0; i<n; i++) v[i] = (float)(i%17) - 8.0f;
+
+		fft_plan_t plan = fft_plan(n);
+		double start = bench_now();
+		for (unsigned r=0; r<reps; r++) {
+			for (unsigned i=0; i<n; i++) x[i] = v[i];
+			fft_exec(&plan, x, fft_forward);
+		}
+
+		double t_c = (bench_now() - start)/reps;
+		fft_plan_free(&plan);
+
+		fft_rplan_t rplan = fft_rplan(n);
+		start = bench_now();
+		for (unsigned r=0; r<reps; r++) fft_r2c(&rplan, v, x);
+		double t_r = (bench_now() - start)/reps;
+		fft_rplan_free(&rplan);
+
+		printf("%8u %14.0f %14.0f %8.2f\n", n, t_c*1e9, t_r*1e9, t_c/t_r);
+
+		drop(v);
+		drop(x);
+	}
+}
+
+//forward and inverse over a cube, as a spectral solve would do every timestep, from 1 thread up to every core
+void bench_fft3() {
+	printf("%8s %8s %14s %10s %8s\n", "grid", "threads", "fwd+inv ms", "mflops", "scaling");
+
+	pool_t* probe = pool_new(0);
+	unsigned cores = pool_threads(probe);
+	pool_free(probe);
+
+	static const unsigned sizes[] = {32, 64, 96, 128, 256};
+	for (unsigned i=0; i<sizeof(sizes)/sizeof(unsigned); i++) {
+		unsigned d = sizes[i], n = d*d*d;
+		unsigned reps = bench_reps(n);
+
+		complex float* x = heap(sizeof(complex float)*n);
+		for (unsigned j=0; j<n; j++) x[j] = (float)(j%17) - 8.0f;
+
+		double t1 = 0;
+		for (unsigned threads=1; ; threads = threads*2 < cores ? threads*2 : cores) {
+			pool_t* pool = pool_new(threads);
+			fft3_plan_t plan = fft3_plan(d, d, d, fft_f32, pool);
+
+			double start = bench_now();
+			for (unsigned r=0; r<reps; r++) {
+				fft3_exec(&plan, x, fft_forward);
+				fft3_exec(&plan, x, fft_inverse);
+			}
+
+			double t = (bench_now() - start)/reps;
+			if (threads == 1) t1 = t;
+
+			fft3_plan_free(&plan);
+			pool_free(pool);
+
+			printf("%6u^3 %8u %14.2f %10.1f %8.2f\n", d, threads, t*1e3, 2*5.0*n*log2(n)/t*1e-6, t1/t);
+			if (threads == cores) break;
+		}
+
+		drop(x);
+	}
+}
+
+//every simd level against the scalar reference, both for time and for how far the outputs drift apart
+void bench_fft_simd() {
+	static const char* names[] = {"scalar", "sse2", "avx2", "avx512"};
+	fft_simd best = fft_simd_detect();
+
+	printf("%8s %8s %12s %10s %12s\n", "n", "level", "ns", "mflops", "max rel err");
+
+	for (unsigned lg=6; lg<=20; lg+=2) {
+		unsigned n = 1u<<lg;
+		unsigned reps = bench_reps(n);
+
+		complex float* in = heap(sizeof(complex float)*n);
+		complex float* ref = heap(sizeof(complex float)*n);
+		complex float* x = heap(sizeof(complex float)*n);
+		for (unsigned i=0; i<n; i++) in[i] = CMPLXF((float)(i%17) - 8.0f, (float)(i%5));
+
+		fft_plan_t plan = fft_plan(n);
+
+		for (fft_simd level=fft_simd_scalar; level<=best; level++) {
+			fft_simd_use(level);
+
+			memcpy(x, in, sizeof(complex float)*n);
+			fft_exec(&plan, x, fft_forward);
+			if (level == fft_simd_scalar) memcpy(ref, x, sizeof(complex float)*n);
+
+			double err = 0, mag = 0;
+			for (unsigned i=0; i<n; i++) {
+				if (cabsf(x[i] - ref[i]) > err) err = cabsf(x[i] - ref[i]);
+				if (cabsf(ref[i]) > mag) mag = cabsf(ref[i]);
+			}
+
+			double start = bench_now();
+			for (unsigned r=0; r<reps; r++) fft_exec(&plan, x, r%2 ? fft_inverse : fft_forward);
+			double t = (bench_now() - start)/reps;
+
+			printf("%8u %8s %12.0f %10.1f %12.2e\n", n, names[level], t*1e9, 5.0*n*lg/t*1e-6, err/mag);
+		}
+
+		fft_simd_use(best);
+		fft_plan_free(&plan);
+
+		drop(in);
+		drop(ref);
+		drop(x);
+	}
+}
+
+//what double precision costs over single, and what it buys after repeated forward/inverse round trips
+void bench_fft_prec() {
+	static const unsigned sizes[] = {256, 4096, 65536, 1u<<20, 1000, 3000, 1009, 65537};
+	static const unsigned trips = 100;
+
+	printf("%8s %12s %12s %8s %14s %14s\n", "n", "f32 ns", "f64 ns", "ratio", "f32 err", "f64 err");
+
+	for (unsigned s=0; s<sizeof(sizes)/sizeof(*sizes); s++) {
+		unsigned n = sizes[s];
+		unsigned reps = bench_reps(n);
+
+		complex float* xf = heap(sizeof(complex float)*n);
+		complex double* xd = heap(sizeof(complex double)*n);
+		complex double* in = heap(sizeof(complex double)*n);
+		for (unsigned i=0; i<n; i++) in[i] = CMPLX((double)(i%17) - 8.0, (double)(i%5));
+
+		fft_plan_t pf = fft_plan_prec(n, fft_f32);
+		fft_plan_t pd = fft_plan_prec(n, fft_f64);
+
+		double t[2];
+		for (unsigned p=0; p<2; p++) {
+			fft_plan_t* plan = p ? &pd : &pf;
+			void* x = p ? (void*)xd : (void*)xf;
+
+			double start = bench_now();
+			for (unsigned r=0; r<reps; r++) fft_exec(plan, x, r%2 ? fft_inverse : fft_forward);
+			t[p] = (bench_now() - start)/reps;
+		}
+
+		//normalized round trips, the error is what accumulates against the original signal
+		for (unsigned i=0; i<n; i++) {
+			xf[i] = CMPLXF((float)creal(in[i]), (float)cimag(in[i]));
+			xd[i] = in[i];
+		}
+
+		for (unsigned r=0; r<trips; r++) {
+			fft_exec(&pf, xf, fft_forward);
+			fft_exec(&pf, xf, fft_inverse);
+			fft_exec(&pd, xd, fft_forward);
+			fft_exec(&pd, xd, fft_inverse);
+
+			for (unsigned i=0; i<n; i++) {
+				xf[i] /= (float)n;
+				xd[i] /= (double)n;
+			}
+		}
+
+		double errf = 0, errd = 0, mag = 0;
+		for (unsigned i=0; i<n; i++) {
+			if (cabs((complex double)xf[i] - in[i]) > errf) errf = cabs((complex double)xf[i] - in[i]);
+			if (cabs(xd[i] - in[i]) > errd) errd = cabs(xd[i] - in[i]);
+			if (cabs(in[i]) > mag) mag = cabs(in[i]);
+		}
+
+		printf("%8u %12.0f %12.0f %8.2f %14.2e %14.2e\n", n, t[0]*1e9, t[1]*1e9, t[1]/t[0], errf/mag, errd/mag);
+
+		fft_plan_free(&pf);
+		fft_plan_free(&pd);
+
+		drop(xf);
+		drop(xd);
+		drop(in);
+	}
+}
+
+//laplacian on a d^3 grid, face neighbours only for the 7 point stencil, every neighbour for the 27 point one
+static csr_t bench_stencil(unsigned d, int full) {
+	sparsemat_t m = sparsemat_new(d*d*d, d*d*d);
+
+	for (unsigned z=0; z<d; z++) for (unsigned y=0; y<d; y++) for (unsigned x=0; x<d; x++) {
+		unsigned r = (z*d + y)*d + x;
+		for (int dz=-1; dz<=1; dz++) for (int dy=-1; dy<=1; dy++) for (int dx=-1; dx<=1; dx++) {
+			int off = abs(dx) + abs(dy) + abs(dz);
+			if (!full && off > 1) continue;
+
+			int nx = (int)x+dx, ny = (int)y+dy, nz = (int)z+dz;
+			if (nx < 0 || ny < 0 || nz < 0 || nx >= (int)d || ny >= (int)d || nz >= (int)d) continue;
+
+			sparsemat_push(&m, r, ((unsigned)nz*d + (unsigned)ny)*d + (unsigned)nx, off ? -1.0 : (full ? 26.0 : 6.0));
+		}
+	}
+
+	csr_t a = sparsemat_freeze(&m);
+	sparsemat_free(&m);
+	return a;
+}
+
+//rows of 1 to 64 entries scattered over the whole vector, the worst case for both balance and x locality
+static csr_t bench_irregular(unsigned n) {
+	sparsemat_t m = sparsemat_new(n, n);
+	unsigned long long seed = 88172645463325252ull;
+
+	for (unsigned r=0; r<n; r++) {
+		seed ^= seed<<13; seed ^= seed>>7; seed ^= seed<<17;
+		unsigned len = 1 + (unsigned)(seed%64);
+
+		for (unsigned i=0; i<len; i++) {
+			seed ^= seed<<13; seed ^= seed>>7; seed ^= seed<<17;
+			sparsemat_push(&m, r, (unsigned)(seed%n), 1.0/(i+1));
+		}
+	}
+
+	csr_t a = sparsemat_freeze(&m);
+	sparsemat_free(&m);
+	return a;
+}
+
+typedef struct {
+	double* a;
+	const double* b;
+	const double* c;
+} bench_triad_t;
+
+static void bench_triad(void* arg, unsigned worker, unsigned begin, unsigned end) {
+	bench_triad_t* t = arg;
+	for (unsigned i=begin; i<end; i++) t->a[i] = t->b[i] + 3.0*t->c[i];
+}
+
+//stream triad a = b + s c over arrays well past the last level cache, best bytes moved per second
+static double bench_stream(pool_t* pool) {
+	unsigned n = 1u<<25;
+	double* a = heap(sizeof(double)*n);
+	double* b = heap(sizeof(double)*n);
+	double* c = heap(sizeof(double)*n);
+	for (unsigned i=0; i<n; i++) a[i] = 0, b[i] = i, c[i] = 1;
+
+	bench_triad_t t = {.a=a, .b=b, .c=c};
+	double best = 0;
+	for (unsigned r=0; r<5; r++) {
+		double start = bench_now();
+		pool_run(pool, bench_triad, &t, n, pool_grain(pool, n));
+		double bw = 3.0*sizeof(double)*n/(bench_now() - start);
+		if (bw > best) best = bw;
+	}
+
+	drop(a);
+	drop(b);
+	drop(c);
+	return best;
+}
+
+//serial csr against the partitioned kernels and sell-4-sigma on every core, as gflop/s and as a share of the
+//triad bandwidth. spmv streams each value and column index once, so the stream figure is its ceiling
+void bench_spmv() {
+	pool_t* pool = pool_new(0);
+	double stream = bench_stream(pool);
+	printf("stream triad %.1f GB/s on %u threads\n\n", stream*1e-9, pool_threads(pool));
+
+	static const char* names[] = {"7pt 96^3", "27pt 64^3", "irregular"};
+	static const char* kernels[] = {"serial", "scalar", "avx2", "sell-4-256"};
+
+	printf("%10s %10s %12s %12s %8s %10s %8s\n", "matrix", "kernel", "nnz", "us", "gflop/s", "GB/s", "stream");
+
+	for (unsigned mi=0; mi<3; mi++) {
+		csr_t a = mi == 0 ? bench_stencil(96, 0) : mi == 1 ? bench_stencil(64, 1) : bench_irregular(1u<<20);
+
+		double* x = heap(sizeof(double)*a.ncols);
+		double* y = heap(sizeof(double)*a.nrows);
+		for (unsigned i=0; i<a.ncols; i++) x[i] = (double)(i%13) - 6.0;
+
+		spmv_t s = spmv_new(&a, pool);
+		sell_t sell = sell_from_csr(&a, 4, 256);
+		unsigned reps = bench_reps(a.nnz/16 + 1);
+
+		//values and indices once, row pointers, y written, x read at least once
+		double bytes = (double)a.nnz*(sizeof(double) + sizeof(unsigned)) + (a.nrows+1.0)*sizeof(unsigned)
+			+ (double)a.nrows*sizeof(double) + (double)a.ncols*sizeof(double);
+
+		for (unsigned k=0; k<4; k++) {
+			if (k == 2 && !cpu_has_avx2()) continue;
+			s.simd = k == 2;
+
+			double start = bench_now();
+			for (unsigned r=0; r<reps; r++) {
+				if (k == 0) csr_spmv(&a, x, y);
+				else if (k == 3) sell_spmv(&sell, pool, x, y);
+				else spmv_exec(&s, x, y);
+			}
+
+			double t = (bench_now() - start)/reps;
+			printf("%10s %10s %12u %12.1f %8.2f %10.1f %7.0f%%\n", names[mi], kernels[k], a.nnz, t*1e6,
+				2.0*a.nnz/t*1e-9, bytes/t*1e-9, 100.0*bytes/t/stream);
+		}
+
+		printf("%10s %10s padding %.1f%%\n", "", "sell", 100.0*(sell.stored - sell.nnz)/(double)sell.nnz);
+
+		spmv_free(&s);
+		sell_free(&sell);
+		csr_free(&a);
+		drop(x);
+		drop(y);
+	}
+
+	pool_free(pool);
+}
+
+//triangulated d*d sheet, each quad split in two, assembled as a graph laplacian the way a surface mesh would be
+static csr_t bench_trimesh(unsigned d) {
+	sparsemat_t m = sparsemat_new(d*d, d*d);
+
+	for (unsigned y=0; y+1<d; y++) for (unsigned x=0; x+1<d; x++) {
+		unsigned q[4] = {y*d + x, y*d + x+1, (y+1)*d + x, (y+1)*d + x+1};
+		unsigned tris[2][3] = {{q[0], q[1], q[3]}, {q[0], q[3], q[2]}};
+
+		for (unsigned t=0; t<2; t++) for (unsigned i=0; i<3; i++) for (unsigned j=0; j<3; j++) {
+			sparsemat_add(&m, tris[t][i], tris[t][j], i == j ? 2.0 : -1.0);
+		}
+	}
+
+	csr_t a = sparsemat_freeze(&m);
+	sparsemat_free(&m);
+	return a;
+}
+
+//meshes come in whatever order their triangles did, a shuffle of the grid numbering stands in for that
+//then rcm and nested dissection from the matrix graph, for bandwidth, profile and parallel spmv time
+void bench_reorder() {
+	pool_t* pool = pool_new(0);
+	static const char* names[] = {"7pt 80^3", "tri 800^2"};
+	static const char* orders[] = {"grid", "shuffled", "rcm", "nd"};
+
+	printf("%10s %9s %10s %12s %14s %12s\n", "matrix", "order", "order ms", "bandwidth", "profile", "spmv us");
+
+	for (unsigned mi=0; mi<2; mi++) {
+		csr_t grid = mi == 0 ? bench_stencil(80, 0) : bench_trimesh(800);
+		unsigned n = grid.nrows;
+
+		reorder_t shuffle = reorder_identity(n);
+		unsigned long long seed = 88172645463325252ull;
+		for (unsigned i=n; i-- > 1;) {
+			seed ^= seed<<13; seed ^= seed>>7; seed ^= seed<<17;
+			unsigned j = (unsigned)(seed%(i+1)), t = shuffle.perm[i];
+			shuffle.perm[i] = shuffle.perm[j];
+			shuffle.perm[j] = t;
+		}
+
+		for (unsigned i=0; i<n; i++) shuffle.iperm[shuffle.perm[i]] = i;
+
+		csr_t a = reorder_csr(&grid, &shuffle);
+		reorder_graph_t g = reorder_graph_csr(&a);
+
+		double* x = heap(sizeof(double)*n);
+		double* y = heap(sizeof(double)*n);
+		for (unsigned i=0; i<n; i++) x[i] = (double)(i%13) - 6.0;
+
+		for (unsigned k=0; k<4; k++) {
+			double order_t = 0;
+			reorder_t p = {0};
+			csr_t b = k == 0 ? grid : a;
+
+			if (k >= 2) {
+				double start = bench_now();
+				p = k == 2 ? reorder_rcm(&g) : reorder_nd(&g);
+				order_t = bench_now() - start;
+				b = reorder_csr(&a, &p);
+			}
+
+			spmv_t s = spmv_new(&b, pool);
+			unsigned reps = bench_reps(b.nnz/16 + 1);
+
+			double start = bench_now();
+			for (unsigned r=0; r<reps; r++) spmv_exec(&s, x, y);
+			double t = (bench_now() - start)/reps;
+
+			printf("%10s %9s %10.1f %12u %14llu %12.1f\n", names[mi], orders[k], order_t*1e3,
+				reorder_bandwidth(&b), reorder_profile(&b), t*1e6);
+
+			spmv_free(&s);
+			if (k >= 2) {
+				csr_free(&b);
+				reorder_free(&p);
+			}
+		}
+
+		reorder_free(&shuffle);
+		reorder_graph_free(&g);
+		csr_free(&grid);
+		csr_free(&a);
+		drop(x);
+		drop(y);
+	}
+
+	pool_free(pool);
+}
+
+//direct solves against ic0 preconditioned cg on the same systems: setup once, then per right hand side
+//for batches of growing size, which is where the factorization pays for itself
+void bench_chol() {
+	static const char* names[] = {"7pt 32^3", "tri 300^2"};
+	static const char* orders[] = {"natural", "rcm", "nd"};
+	static const unsigned batches[] = {1, 8, 32};
+
+	printf("%10s %8s %10s %10s %12s %10s %10s %10s %8s\n", "matrix", "order", "symbolic", "factor", "nnz(l)",
+		"1 rhs us", "8 rhs us", "32 rhs us", "resid");
+
+	for (unsigned mi=0; mi<2; mi++) {
+		csr_t a = mi == 0 ? bench_stencil(32, 0) : bench_trimesh(300);
+		unsigned n = a.nrows;
+
+		//the graph laplacians are singular, a mass like shift makes them definite
+		for (unsigned r=0; r<n; r++) {
+			for (unsigned i=a.row_ptr[r]; i<a.row_ptr[r+1]; i++) if (a.col[i] == r) a.val[i] += 1e-2;
+		}
+
+		double* b = heap(sizeof(double)*n*32);
+		double* x = heap(sizeof(double)*n*32);
+		double* res = heap(sizeof(double)*n);
+		for (unsigned i=0; i<n*32; i++) b[i] = (double)(i%13) - 6.0;
+
+		//banded orders take tens of seconds on the 3d grid, there nd runs alone
+		for (unsigned o=mi == 0 ? chol_nd : chol_rcm; o<=chol_nd; o++) {
+			double start = bench_now();
+			chol_t c = chol_new(&a, chol_llt, (chol_order)o);
+			double sym = bench_now() - start;
+
+			start = bench_now();
+			chol_factor(&c, &a);
+			double fac = bench_now() - start;
+
+			double per[3];
+			for (unsigned k=0; k<3; k++) {
+				start = bench_now();
+				chol_solve(&c, b, x, batches[k]);
+				per[k] = (bench_now() - start)/batches[k];
+			}
+
+			csr_spmv(&a, x, res);
+			double err = 0, mag = 0;
+			for (unsigned i=0; i<n; i++) {
+				err += (res[i] - b[i])*(res[i] - b[i]);
+				mag += b[i]*b[i];
+			}
+
+			printf("%10s %8s %8.1fms %8.1fms %12zu %10.0f %10.0f %10.0f %8.1e\n", names[mi], orders[o], sym*1e3, fac*1e3,
+				c.nnz, per[0]*1e6, per[1]*1e6, per[2]*1e6, sqrt(err/mag));
+
+			chol_free(&c);
+		}
+
+		//the iterative baseline pays its whole cost again for every right hand side
+		double start = bench_now();
+		precond_t pre = precond_new(&a, precond_ic0);
+		cg_t cg = cg_new(&a, &pre, 1e-10, 10000);
+		double setup = bench_now() - start;
+
+		start = bench_now();
+		for (unsigned k=0; k<8; k++) {
+			memset(x + (size_t)k*n, 0, sizeof(double)*n);
+			cg_solve(&cg, b + (size_t)k*n, x + (size_t)k*n);
+		}
+
+		double per = (bench_now() - start)/8;
+		printf("%10s %8s %8.1fms %10s %12s %10.0f %10s %10s %8s (%u iterations)\n", names[mi], "cg ic0", setup*1e3, "", "",
+			per*1e6, "", "", "1e-10", cg.iters);
+
+		cg_free(&cg);
+		precond_free(&pre);
+		csr_free(&a);
+		drop(b);
+		drop(x);
+		drop(res);
+	}
+}
+
+//cg iterations as the 3d poisson grid refines, ic0 against an amg v-cycle, and amg on its own
+//the hierarchy is built once and reused for four right hand sides, as a time loop would
+void bench_amg() {
+	static const unsigned sizes[] = {24, 48, 96};
+	static const char* names[] = {"none", "ic0", "amg", "amg only"};
+
+	printf("%8s %10s %10s %8s %12s %12s\n", "grid", "precond", "setup ms", "iters", "solve ms", "4 solves ms");
+
+	for (unsigned si=0; si<sizeof(sizes)/sizeof(*sizes); si++) {
+		unsigned d = sizes[si];
+		csr_t a = bench_stencil(d, 0);
+		unsigned n = a.nrows;
+
+		//dirichlet walls: the stencil rows at the boundary miss neighbours, which keeps a definite
+		double* b = heap(sizeof(double)*n);
+		double* x = heap(sizeof(double)*n);
+		for (unsigned i=0; i<n; i++) b[i] = 1.0 + 0.5*sin(0.01*i);
+
+		for (unsigned k=0; k<4; k++) {
+			double start = bench_now();
+			precond_t pre = precond_new(&a, k == 1 ? precond_ic0 : k >= 2 ? precond_amg : precond_none);
+			double setup = bench_now() - start;
+
+			cg_t cg = cg_new(&a, k ? &pre : NULL, 1e-8, 20000);
+			unsigned iters = 0;
+			double first = 0;
+
+			start = bench_now();
+			for (unsigned r=0; r<4; r++) {
+				for (unsigned i=0; i<n; i++) b[i] += 0.1*r;
+				memset(x, 0, sizeof(double)*n);
+
+				if (k == 3) {
+					amg_solve(&pre.amg, b, x, 1e-8, 500);
+					iters = pre.amg.iters;
+				} else {
+					cg_solve(&cg, b, x);
+					iters = cg.iters;
+				}
+
+				if (r == 0) first = bench_now() - start;
+			}
+
+			double all = bench_now() - start;
+			printf("%6u^3 %10s %10.1f %8u %12.1f %12.1f\n", d, names[k], setup*1e3, iters, first*1e3, all*1e3);
+
+			cg_free(&cg);
+			precond_free(&pre);
+		}
+
+		csr_free(&a);
+		drop(b);
+		drop(x);
+	}
+}
+
+//7 point stencil on a d^3 grid with a dense bs*bs coupling per node pair, vector unknowns interleaved per node
+static csr_t bench_block_stencil(unsigned d, unsigned bs) {
+	unsigned nodes = d*d*d;
+	sparsemat_t m = sparsemat_new(nodes*bs, nodes*bs);
+	static const int off[7][3] = {{0,0,0}, {-1,0,0}, {1,0,0}, {0,-1,0}, {0,1,0}, {0,0,-1}, {0,0,1}};
+
+	for (unsigned z=0; z<d; z++) for (unsigned y=0; y<d; y++) for (unsigned x=0; x<d; x++) {
+		unsigned r = (z*d + y)*d + x;
+		for (unsigned k=0; k<7; k++) {
+			int nx = (int)x+off[k][0], ny = (int)y+off[k][1], nz = (int)z+off[k][2];
+			if (nx < 0 || ny < 0 || nz < 0 || nx >= (int)d || ny >= (int)d || nz >= (int)d) continue;
+
+			unsigned c = ((unsigned)nz*d + (unsigned)ny)*d + (unsigned)nx;
+			for (unsigned i=0; i<bs; i++) for (unsigned j=0; j<bs; j++) {
+				sparsemat_push(&m, r*bs + i, c*bs + j, k ? -1.0/(1 + i + j) : (i == j ? 12.0 : 0.5));
+			}
+		}
+	}
+
+	csr_t a = sparsemat_freeze(&m);
+	sparsemat_free(&m);
+	return a;
+}
+
+//csr, serial and partitioned, against bsr on the same vector valued matrices: index memory and time
+void bench_bsr() {
+	pool_t* pool = pool_new(0);
+	static const char* kernels[] = {"csr", "csr pool", "bsr", "bsr pool"};
+
+	printf("%4s %10s %12s %14s %10s %10s\n", "bs", "kernel", "index KiB", "total KiB", "us", "gflop/s");
+
+	for (unsigned bs=3; bs<=4; bs++) {
+		csr_t a = bench_block_stencil(48, bs);
+		bsr_t b = bsr_from_csr(&a, bs);
+		spmv_t s = spmv_new(&a, pool);
+
+		double* x = heap(sizeof(double)*a.ncols);
+		double* y = heap(sizeof(double)*a.nrows);
+		for (unsigned i=0; i<a.ncols; i++) x[i] = (double)(i%13) - 6.0;
+
+		size_t csr_index = sizeof(unsigned)*((size_t)a.nrows + 1 + a.nnz);
+		size_t csr_total = csr_index + sizeof(double)*a.nnz;
+		size_t bsr_total = bsr_index_bytes(&b) + sizeof(double)*bs*bs*b.nnzb;
+		unsigned reps = bench_reps(a.nnz/16 + 1);
+
+		for (unsigned k=0; k<4; k++) {
+			double start = bench_now();
+			for (unsigned r=0; r<reps; r++) {
+				if (k == 0) csr_spmv(&a, x, y);
+				else if (k == 1) spmv_exec(&s, x, y);
+				else bsr_spmv(&b, k == 3 ? pool : NULL, x, y);
+			}
+
+			double t = (bench_now() - start)/reps;
+			printf("%4u %10s %12zu %14zu %10.1f %10.2f\n", bs, kernels[k], (k < 2 ? csr_index : bsr_index_bytes(&b))/1024,
+				(k < 2 ? csr_total : bsr_total)/1024, t*1e6, 2.0*a.nnz/t*1e-9);
+		}
+
+		spmv_free(&s);
+		bsr_free(&b);
+		csr_free(&a);
+		drop(x);
+		drop(y);
+	}
+
+	pool_free(pool);
+}
+
+//a d*d vertex sheet bent into a bump, two triangles per cell, about a million triangles at d=708
+static void bench_sheet(unsigned d, unsigned** tris_out, float** pos_out) {
+	unsigned* tris = heap(sizeof(unsigned)*6*(d-1)*(d-1));
+	float* pos = heap(sizeof(float)*3*d*d);
+
+	for (unsigned y=0; y<d; y++) for (unsigned x=0; x<d; x++) {
+		float* p = pos + 3*(y*d + x);
+		p[0] = (float)x/(float)d;
+		p[1] = (float)y/(float)d;
+		p[2] = 0.25f*sinf(3.0f*p[0])*cosf(2.0f*p[1]);
+	}
+
+	unsigned* t = tris;
+	for (unsigned y=0; y+1<d; y++) for (unsigned x=0; x+1<d; x++) {
+		unsigned q[4] = {y*d + x, y*d + x+1, (y+1)*d + x, (y+1)*d + x+1};
+		unsigned cell[6] = {q[0], q[1], q[3], q[0], q[3], q[2]};
+		memcpy(t, cell, sizeof(cell));
+		t += 6;
+	}
+
+	*tris_out = tris;
+	*pos_out = pos;
+}
+
+//element order through the hashed builder against the colored assembly, serial and on the pool
+//the two colored runs have to agree bit for bit, the builder only up to summation order
+void bench_assemble() {
+	pool_t* pool = pool_new(0);
+	unsigned d = 708, nnodes = d*d, nelems = 2*(d-1)*(d-1);
+	unsigned* tris;
+	float* pos;
+	bench_sheet(d, &tris, &pos);
+	mesh_t mesh = mesh_from_strided(pos, sizeof(float)*3, NULL, nnodes);
+
+	printf("%u nodes, %u triangles, %u threads\n", nnodes, nelems, pool_threads(pool));
+
+	double start = bench_now();
+	sparsemat_t m = sparsemat_new(nnodes, nnodes);
+	double ke[9], fe[3];
+	for (unsigned e=0; e<nelems; e++) {
+		memset(ke, 0, sizeof(ke));
+		assembly_laplace_tri(&mesh, e, tris + 3*e, ke, fe);
+		for (unsigned i=0; i<3; i++) for (unsigned j=0; j<3; j++) sparsemat_add(&m, tris[3*e+i], tris[3*e+j], ke[i*3 + j]);
+	}
+
+	csr_t ref = sparsemat_freeze(&m);
+	sparsemat_free(&m);
+	printf("%-18s %10.1f ms\n", "sparsemat_add", (bench_now() - start)*1e3);
+
+	start = bench_now();
+	assembly_t serial = assembly_new(nnodes, tris, nelems, 3, NULL);
+	printf("%-18s %10.1f ms, %u colors\n", "symbolic", (bench_now() - start)*1e3, serial.ncolors);
+
+	assembly_t par = assembly_new(nnodes, tris, nelems, 3, pool);
+
+	unsigned reps = bench_reps((unsigned)(nelems/64) + 1);
+	static const char* names[] = {"colored serial", "colored pool"};
+	for (unsigned k=0; k<2; k++) {
+		assembly_t* as = k ? &par : &serial;
+		start = bench_now();
+		for (unsigned r=0; r<reps; r++) assembly_run(as, assembly_laplace_tri, &mesh);
+		double t = (bench_now() - start)/reps;
+		printf("%-18s %10.1f ms, %.1f Melem/s\n", names[k], t*1e3, nelems/t*1e-6);
+	}
+
+	unsigned same = serial.a.nnz == par.a.nnz && memcmp(serial.a.val, par.a.val, sizeof(double)*par.a.nnz) == 0
+		&& memcmp(serial.b, par.b, sizeof(double)*nnodes) == 0;
+
+	double diff = 0;
+	for (unsigned i=0; i<ref.nnz && ref.nnz == par.a.nnz; i++) {
+		if (fabs(ref.val[i] - par.a.val[i]) > diff) diff = fabs(ref.val[i] - par.a.val[i]);
+	}
+
+	printf("pool bitwise equal to serial: %s, max diff to sparsemat_add %.2e\n", same ? "yes" : "no", diff);
+
+	assembly_free(&serial);
+	assembly_free(&par);
+	csr_free(&ref);
+	drop(tris);
+	drop(pos);
+	mesh_free(&mesh);
+	pool_free(pool);
+}
+
+//laplacian plus a lumped mass term, spd without boundary conditions
+static void bench_screened_tri(void* arg, unsigned elem, const unsigned* nodes, double* ke, double* fe) {
+	assembly_laplace_tri(arg, elem, nodes, ke, fe);
+	for (unsigned i=0; i<3; i++) ke[i*3 + i] += 1e3*fe[i];
+}
+
+static void bench_spmv_apply(void* arg, const double* x, double* y) {
+	spmv_exec(arg, x, y);
+}
+
+//assembled csr against the element loop: bytes held for the operator, one apply, and jacobi cg for a fixed
+//number of iterations. connectivity and positions are the mesh's and counted for neither
+void bench_matfree() {
+	pool_t* pool = pool_new(0);
+	unsigned d = 708, nnodes = d*d, nelems = 2*(d-1)*(d-1);
+	unsigned* tris;
+	float* pos;
+	bench_sheet(d, &tris, &pos);
+	mesh_t mesh = mesh_from_strided(pos, sizeof(float)*3, NULL, nnodes);
+
+	assembly_t as = assembly_new(nnodes, tris, nelems, 3, pool);
+	assembly_run(&as, bench_screened_tri, &mesh);
+	spmv_t s = spmv_new(&as.a, pool);
+
+	assembly_t mf = assembly_matfree_new(nnodes, tris, nelems, 3, pool);
+	assembly_op_t op = {.as=&mf, .fn=bench_screened_tri, .arg=&mesh};
+
+	double* diag = heap(sizeof(double)*nnodes);
+	assembly_diag(&mf, bench_screened_tri, &mesh, diag);
+	precond_t pre_mf = precond_diag_new(nnodes, diag);
+	precond_t pre = precond_new(&as.a, precond_jacobi);
+
+	size_t csr_bytes = sizeof(unsigned)*((size_t)nnodes + 1 + as.a.nnz) + sizeof(double)*as.a.nnz;
+	size_t mf_bytes = sizeof(unsigned)*((size_t)mf.nelems + mf.ncolors + 1);
+
+	double* x = heap(sizeof(double)*nnodes);
+	double* y = heap(sizeof(double)*nnodes);
+	for (unsigned i=0; i<nnodes; i++) x[i] = (double)(i%13) - 6.0;
+
+	printf("%u nodes, %u triangles, %u threads\n", nnodes, nelems, pool_threads(pool));
+	printf("%-16s %12s %10s %10s %8s %12s\n", "operator", "KiB", "apply ms", "cg ms", "iters", "residual");
+
+	static const char* names[] = {"csr", "csr pool", "matfree pool"};
+	unsigned reps = bench_reps(as.a.nnz/16 + 1);
+	for (unsigned k=0; k<3; k++) {
+		krylov_op_t kop = k == 0 ? krylov_csr(&as.a)
+			: k == 1 ? (krylov_op_t){.n=nnodes, .apply=bench_spmv_apply, .arg=&s}
+			: (krylov_op_t){.n=nnodes, .apply=assembly_op_apply, .arg=&op};
+
+		double start = bench_now();
+		for (unsigned r=0; r<reps; r++) kop.apply(kop.arg, x, y);
+		double apply_t = (bench_now() - start)/reps;
+
+		double* sol = heap(sizeof(double)*nnodes);
+		memset(sol, 0, sizeof(double)*nnodes);
+		cg_t cg = cg_new_op(kop, k == 2 ? &pre_mf : &pre, 1e-14, 200);
+
+		start = bench_now();
+		cg_solve(&cg, as.b, sol);
+		double solve_t = bench_now() - start;
+
+		printf("%-16s %12zu %10.2f %10.1f %8u %12.3e\n", names[k], (k == 2 ? mf_bytes : csr_bytes)/1024, apply_t*1e3,
+			solve_t*1e3, cg.iters, cg.residual);
+
+		cg_free(&cg);
+		drop(sol);
+	}
+
+	precond_free(&pre);
+	precond_free(&pre_mf);
+	spmv_free(&s);
+	assembly_free(&as);
+	assembly_free(&mf);
+	drop(diag);
+	drop(x);
+	drop(y);
+	drop(tris);
+	drop(pos);
+	mesh_free(&mesh);
+	pool_free(pool);
+}
+
+//what physics_obj used to do: a zero terminated, +1 shifted edge list per vertex, scanned for repeats and
+//grown with resize on every triangle touching it
+static unsigned** bench_adj_lists(const unsigned* tris, unsigned ntris, unsigned n, size_t* allocs) {
+	unsigned** lists = heap(sizeof(unsigned*)*(n ? n : 1));
+	memset(lists, 0, sizeof(unsigned*)*n);
+
+	for (unsigned t=0; t<ntris; t++) {
+		const unsigned* v = tris + (size_t)t*3;
+		for (unsigned i=0; i<3; i++) {
+			unsigned add[2] = {v[(i+1)%3] + 1, v[(i+2)%3] + 1};
+
+			if (!lists[v[i]]) {
+				lists[v[i]] = heapcpy(sizeof(unsigned)*3, (unsigned[]){add[0], add[1], 0});
+				(*allocs)++;
+				continue;
+			}
+
+			unsigned count = 0;
+			for (unsigned* x=lists[v[i]]; *x; x++, count++) {
+				if (*x == add[0]) add[0] = 0;
+				if (*x == add[1]) add[1] = 0;
+			}
+
+			for (unsigned k=0; k<2; k++) {
+				if (!add[k]) continue;
+				lists[v[i]] = resize(lists[v[i]], sizeof(unsigned)*(count+2));
+				(*allocs)++;
+				lists[v[i]][count++] = add[k];
+				lists[v[i]][count] = 0;
+			}
+		}
+	}
+
+	return lists;
+}
+
+//vertex adjacency of the sheet mesh with its vertices shuffled, as they come out of a loader
+void bench_adjacency() {
+	unsigned d = 708, n = d*d, ntris = 2*(d-1)*(d-1);
+	unsigned* tris;
+	float* pos;
+	bench_sheet(d, &tris, &pos);
+
+	unsigned* relabel = heap(sizeof(unsigned)*n);
+	for (unsigned i=0; i<n; i++) relabel[i] = i;
+	unsigned long long seed = 88172645463325252ull;
+	for (unsigned i=n; i-- > 1;) {
+		seed ^= seed<<13; seed ^= seed>>7; seed ^= seed<<17;
+		unsigned j = (unsigned)(seed%(i+1)), t = relabel[i];
+		relabel[i] = relabel[j];
+		relabel[j] = t;
+	}
+
+	for (size_t i=0; i<(size_t)ntris*3; i++) tris[i] = relabel[tris[i]];
+
+	printf("%u vertices, %u triangles\n", n, ntris);
+
+	size_t allocs = 0;
+	double start = bench_now();
+	unsigned** lists = bench_adj_lists(tris, ntris, n, &allocs);
+	double lists_t = bench_now() - start;
+
+	size_t lists_entries = 0;
+	for (unsigned v=0; v<n; v++) {
+		for (unsigned* x=lists[v]; x && *x; x++) lists_entries++;
+	}
+
+	start = bench_now();
+	reorder_graph_t g = reorder_graph_tris(tris, ntris, n);
+	double csr_t = bench_now() - start;
+
+	//same neighbour sets, the lists unsorted
+	unsigned same = lists_entries == g.ptr[n];
+	for (unsigned v=0; v<n && same; v++) {
+		for (unsigned* x=lists[v]; x && *x; x++) {
+			unsigned u = *x - 1, lo = g.ptr[v], hi = g.ptr[v+1];
+			while (lo < hi) {
+				unsigned mid = (lo + hi)/2;
+				if (g.adj[mid] < u) lo = mid+1;
+				else hi = mid;
+			}
+
+			if (lo == g.ptr[v+1] || g.adj[lo] != u) same = 0;
+		}
+	}
+
+	printf("%-12s %10.1f ms, %zu allocations\n", "edge lists", lists_t*1e3, allocs);
+	printf("%-12s %10.1f ms, 2 allocations, %u entries\n", "csr", csr_t*1e3, g.ptr[n]);
+	printf("same neighbours: %s\n", same ? "yes" : "no");
+
+	for (unsigned v=0; v<n; v++) drop(lists[v]);
+	drop(lists);
+	reorder_graph_free(&g);
+	drop(relabel);
+	drop(tris);
+	drop(pos);
+}
+
+//unindexed triangle soup of the sheet, three corners per triangle as scanners and stl files hand them over,
+//then the same with every corner jittered well below eps
+void bench_weld() {
+	pool_t* pool = pool_new(0);
+	unsigned d = 708, n = d*d, ntris = 2*(d-1)*(d-1), corners = ntris*3;
+	unsigned* tris;
+	float* pos;
+	bench_sheet(d, &tris, &pos);
+
+	float* soup = heap(sizeof(float)*3*corners);
+	for (unsigned i=0; i<corners; i++) memcpy(soup + 3*i, pos + 3*tris[i], sizeof(float)*3);
+
+	printf("%u corners of %u vertices, %u threads\n", corners, n, pool_threads(pool));
+	printf("%-16s %10s %10s %8s\n", "weld", "ms", "vertices", "same");
+
+	double start = bench_now();
+	map_t loc = map_new();
+	map_configure_uint96_key(&loc, sizeof(unsigned));
+	unsigned* remap = heap(sizeof(unsigned)*corners);
+	unsigned nverts = 0;
+	for (unsigned i=0; i<corners; i++) {
+		map_insert_result res = map_insertcpy_noexist(&loc, soup + 3*i, &nverts);
+		if (!res.exists) nverts++;
+		remap[i] = *(unsigned*)res.val;
+	}
+
+	printf("%-16s %10.1f %10u %8s\n", "map serial", (bench_now() - start)*1e3, nverts, "-");
+	map_free(&loc);
+
+	static const char* names[] = {"exact serial", "exact pool", "eps serial", "eps pool"};
+	weld_t prev = {0};
+	for (unsigned k=0; k<4; k++) {
+		if (k == 2) {
+			unsigned long long seed = 88172645463325252ull;
+			for (unsigned i=0; i<3*corners; i++) {
+				seed ^= seed<<13; seed ^= seed>>7; seed ^= seed<<17;
+				soup[i] += (float)((double)(seed%2001)/1000.0 - 1.0)*1e-7f;
+			}
+		}
+
+		start = bench_now();
+		weld_t w = weld_new(soup, sizeof(float)*3, NULL, corners, k < 2 ? 0 : 1e-4f, k%2 ? pool : NULL);
+		double t = bench_now() - start;
+
+		//exact against the map, the pool runs against the serial ones
+		const unsigned* against = k == 0 ? remap : k%2 ? prev.remap : NULL;
+		const char* same = against ? memcmp(w.remap, against, sizeof(unsigned)*corners) == 0 ? "yes" : "no" : "-";
+		printf("%-16s %10.1f %10u %8s\n", names[k], t*1e3, w.n, same);
+
+		if (k%2) {
+			weld_free(&prev);
+			weld_free(&w);
+		} else {
+			prev = w;
+		}
+	}
+
+	drop(remap);
+	drop(soup);
+	drop(tris);
+	drop(pos);
+	pool_free(pool);
+}
+
+//a d*d latitude longitude grid wrapped into a bumpy sphere, closed but for the pole fans
+static void bench_sphere(unsigned d, unsigned** tris_out, float** pos_out, unsigned* ntris) {
+	float* pos = heap(sizeof(float)*3*d*d);
+	for (unsigned i=0; i<d; i++) for (unsigned j=0; j<d; j++) {
+		float th = (float)M_PI*(float)i/(float)(d-1), ph = 2.0f*(float)M_PI*(float)j/(float)d;
+		float r = 1.0f + 0.1f*sinf(5.0f*th)*cosf(4.0f*ph);
+		float* p = pos + 3*(i*d + j);
+		p[0] = r*sinf(th)*cosf(ph);
+		p[1] = r*cosf(th);
+		p[2] = r*sinf(th)*sinf(ph);
+	}
+
+	unsigned* tris = heap(sizeof(unsigned)*6*(d-1)*d);
+	unsigned* t = tris;
+	for (unsigned i=0; i+1<d; i++) for (unsigned j=0; j<d; j++) {
+		unsigned q[4] = {i*d + j, i*d + (j+1)%d, (i+1)*d + j, (i+1)*d + (j+1)%d};
+		unsigned cell[6] = {q[0], q[1], q[3], q[0], q[3], q[2]};
+		memcpy(t, cell, sizeof(cell));
+		t += 6;
+	}
+
+	*tris_out = tris;
+	*pos_out = pos;
+	*ntris = 2*(d-1)*d;
+}
+
+typedef struct {
+	const bvh_t* bvh;
+	unsigned w, h;
+	unsigned mode; //0 single rays, 1 2x2 packets, 2 4x2 packets
+	unsigned* hits; //per row
+} bench_rays_t;
+
+static void bench_ray_dir(const bench_rays_t* job, unsigned x, unsigned y, float* d) {
+	d[0] = ((float)x + 0.5f)/(float)job->w*2.0f - 1.0f;
+	d[1] = ((float)y + 0.5f)/(float)job->h*2.0f - 1.0f;
+	d[2] = 1.5f;
+}
+
+//a pinhole camera at z=-3 over the sphere, one task per row pair so packets stay inside a task
+static void bench_rays(void* arg, unsigned worker, unsigned begin, unsigned end) {
+	bench_rays_t* job = arg;
+	static const float org[3] = {0, 0, -3};
+	unsigned pw = job->mode == 2 ? 4 : 2;
+
+	for (unsigned row=begin; row<end; row++) {
+		unsigned cnt = 0, y0 = row*2;
+
+		if (job->mode == 0) {
+			for (unsigned y=y0; y<y0+2; y++) for (unsigned x=0; x<job->w; x++) {
+				float d[3];
+				bvh_hit_t hit;
+				bench_ray_dir(job, x, y, d);
+				cnt += bvh_intersect(job->bvh, org, d, INFINITY, &hit);
+			}
+		} else {
+			for (unsigned x0=0; x0<job->w; x0+=pw) {
+				bvh_packet_t pk = {.n=pw*2};
+				for (unsigned j=0; j<pk.n; j++) {
+					float d[3];
+					bench_ray_dir(job, x0 + j%pw, y0 + j/pw, d);
+					for (unsigned k=0; k<3; k++) {
+						pk.org[k][j] = org[k];
+						pk.dir[k][j] = d[k];
+					}
+
+					pk.tmax[j] = INFINITY;
+				}
+
+				bvh_hit_t hits[BVH_PACKET];
+				bvh_intersect_packet(job->bvh, &pk, hits);
+				for (unsigned j=0; j<pk.n; j++) cnt += hits[j].tri != (unsigned)-1;
+			}
+		}
+
+		job->hits[row] = cnt;
+	}
+}
+
+//build time serial and on the pool, then camera rays one at a time and as 4 and 8 ray packets
+void bench_bvh() {
+	pool_t* pool = pool_new(0);
+	unsigned* tris;
+	float* pos;
+	unsigned ntris;
+	bench_sphere(708, &tris, &pos, &ntris);
+	mesh_t mesh = mesh_from_strided(pos, sizeof(float)*3, NULL, 708*708);
+
+	printf("%u triangles, %u threads\n", ntris, pool_threads(pool));
+
+	double start = bench_now();
+	bvh_t serial = bvh_new(&mesh, tris, ntris, NULL);
+	double serial_t = bench_now() - start;
+
+	start = bench_now();
+	bvh_t bvh = bvh_new(&mesh, tris, ntris, pool);
+	double par_t = bench_now() - start;
+
+	unsigned same = serial.nnodes == bvh.nnodes && memcmp(serial.nodes, bvh.nodes, sizeof(bvh_node_t)*bvh.nnodes) == 0;
+	printf("build %.1f ms serial, %.1f ms pool, %u nodes, %zu KiB, same tree: %s\n", serial_t*1e3, par_t*1e3,
+		bvh.nnodes, bvh_bytes(&bvh)/1024, same ? "yes" : "no");
+	bvh_free(&serial);
+
+	bench_rays_t job = {.bvh=&bvh, .w=1024, .h=1024};
+	job.hits = heap(sizeof(unsigned)*job.h/2);
+
+	static const char* names[] = {"single", "packet 4", "packet 8"};
+	printf("%-10s %6s %10s %10s %12s\n", "rays", "simd", "ms", "Mrays/s", "hits");
+
+	for (unsigned simd=0; simd<2; simd++) {
+		if (simd && !cpu_has_avx2()) break;
+		bvh.simd = (int)simd;
+
+		for (unsigned mode=0; mode<3; mode++) {
+			if (simd && mode == 0) continue; //the single ray path is scalar only
+			job.mode = mode;
+
+			start = bench_now();
+			pool_run(pool, bench_rays, &job, job.h/2, 1);
+			double t = bench_now() - start;
+
+			unsigned long long total = 0;
+			for (unsigned r=0; r<job.h/2; r++) total += job.hits[r];
+			printf("%-10s %6s %10.1f %10.2f %12llu\n", names[mode], simd ? "avx2" : "-", t*1e3,
+				(double)job.w*job.h/t*1e-6, total);
+		}
+	}
+
+	drop(job.hits);
+	bvh_free(&bvh);
+	drop(tris);
+	drop(pos);
+	mesh_free(&mesh);
+	pool_free(pool);
+}
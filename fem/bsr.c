@@ -0,0 +1,215 @@
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BSR_X86
+#include <immintrin.h>
+#endif
+
+#include "util.h"
+#include "sparsemat.h"
+#include "cpu.h"
+#include "pool.h"
+
+//block sparse row: fixed bs*bs dense blocks, one column index per block instead of per entry
+//vector valued unknowns (3 field components, or 4 with a potential) give exactly this structure
+typedef struct {
+	unsigned nbrows, nbcols; //in blocks
+	unsigned bs;
+	unsigned nnzb;
+
+	unsigned* row_ptr; //nbrows+1
+	unsigned* col; //block columns, sorted within each block row
+	double* val; //nnzb blocks of bs*bs, column major so a block column lines up with a slice of y
+	int simd; //avx2 4x4 blocks
+} bsr_t;
+
+//every block holding a nonzero of a is stored whole. a's dimensions have to be multiples of bs, anything else
+//gives an empty bsr_t with bs 0 and nothing allocated instead of blocks that cut across rows or columns
+bsr_t bsr_from_csr(const csr_t* a, unsigned bs) {
+	if (bs == 0 || a->nrows%bs || a->ncols%bs) return (bsr_t){0};
+
+	bsr_t b = {.nbrows=a->nrows/bs, .nbcols=a->ncols/bs, .bs=bs};
+	b.simd = bs == 4 && cpu_has_avx2();
+	b.row_ptr = heap(sizeof(unsigned)*(b.nbrows+1));
+
+	unsigned* last = heap(sizeof(unsigned)*(b.nbcols ? b.nbcols : 1)); //block row that last saw each block column
+	unsigned* slot = heap(sizeof(unsigned)*(b.nbcols ? b.nbcols : 1));
+	memset(last, 0xff, sizeof(unsigned)*b.nbcols);
+
+	b.row_ptr[0] = 0;
+	for (unsigned br=0; br<b.nbrows; br++) {
+		unsigned cnt = 0;
+		for (unsigned r=br*bs; r<(br+1)*bs; r++) {
+			for (unsigned i=a->row_ptr[r]; i<a->row_ptr[r+1]; i++) {
+				unsigned bc = a->col[i]/bs;
+				if (last[bc] != br) {
+					last[bc] = br;
+					cnt++;
+				}
+			}
+		}
+
+		b.row_ptr[br+1] = b.row_ptr[br] + cnt;
+	}
+
+	b.nnzb = b.row_ptr[b.nbrows];
+	b.col = heap(sizeof(unsigned)*(b.nnzb ? b.nnzb : 1));
+	b.val = heap(sizeof(double)*bs*bs*(b.nnzb ? b.nnzb : 1));
+	memset(b.val, 0, sizeof(double)*bs*bs*b.nnzb);
+	memset(last, 0xff, sizeof(unsigned)*b.nbcols);
+
+	for (unsigned br=0; br<b.nbrows; br++) {
+		unsigned begin = b.row_ptr[br], end = begin;
+
+		//the rows of a are sorted, so merging their block columns in first seen order and sorting after is cheap
+		for (unsigned r=br*bs; r<(br+1)*bs; r++) {
+			for (unsigned i=a->row_ptr[r]; i<a->row_ptr[r+1]; i++) {
+				unsigned bc = a->col[i]/bs;
+				if (last[bc] != br) {
+					last[bc] = br;
+					b.col[end++] = bc;
+				}
+			}
+		}
+
+		for (unsigned i=begin+1; i<end; i++) {
+			unsigned c = b.col[i], j = i;
+			for (; j>begin && b.col[j-1] > c; j--) b.col[j] = b.col[j-1];
+			b.col[j] = c;
+		}
+
+		for (unsigned i=begin; i<end; i++) slot[b.col[i]] = i;
+
+		for (unsigned r=br*bs; r<(br+1)*bs; r++) {
+			for (unsigned i=a->row_ptr[r]; i<a->row_ptr[r+1]; i++) {
+				unsigned c = a->col[i];
+				double* blk = b.val + (size_t)slot[c/bs]*bs*bs;
+				blk[(c%bs)*bs + r%bs] = a->val[i];
+			}
+		}
+	}
+
+	drop(last);
+	drop(slot);
+	return b;
+}
+
+//fully unrolled 3x3, nine multiply adds per block held in registers across the row
+static void bsr_rows3(const bsr_t* b, const double* x, double* y, unsigned begin, unsigned end) {
+	for (unsigned br=begin; br<end; br++) {
+		double y0 = 0, y1 = 0, y2 = 0;
+		for (unsigned i=b->row_ptr[br]; i<b->row_ptr[br+1]; i++) {
+			const double* v = b->val + (size_t)i*9;
+			const double* xb = x + (size_t)b->col[i]*3;
+			double x0 = xb[0], x1 = xb[1], x2 = xb[2];
+
+			y0 += v[0]*x0 + v[3]*x1 + v[6]*x2;
+			y1 += v[1]*x0 + v[4]*x1 + v[7]*x2;
+			y2 += v[2]*x0 + v[5]*x1 + v[8]*x2;
+		}
+
+		y[br*3] = y0;
+		y[br*3+1] = y1;
+		y[br*3+2] = y2;
+	}
+}
+
+static void bsr_rows4(const bsr_t* b, const double* x, double* y, unsigned begin, unsigned end) {
+	for (unsigned br=begin; br<end; br++) {
+		double y0 = 0, y1 = 0, y2 = 0, y3 = 0;
+		for (unsigned i=b->row_ptr[br]; i<b->row_ptr[br+1]; i++) {
+			const double* v = b->val + (size_t)i*16;
+			const double* xb = x + (size_t)b->col[i]*4;
+
+			for (unsigned j=0; j<4; j++) {
+				y0 += v[j*4]*xb[j];
+				y1 += v[j*4+1]*xb[j];
+				y2 += v[j*4+2]*xb[j];
+				y3 += v[j*4+3]*xb[j];
+			}
+		}
+
+		y[br*4] = y0;
+		y[br*4+1] = y1;
+		y[br*4+2] = y2;
+		y[br*4+3] = y3;
+	}
+}
+
+#ifdef BSR_X86
+
+//a 4x4 block column is one register: four broadcasts and four fmas per block, no gathers or horizontal sums
+__attribute__((target("avx2,fma")))
+static void bsr_rows4_avx2(const bsr_t* b, const double* x, double* y, unsigned begin, unsigned end) {
+	for (unsigned br=begin; br<end; br++) {
+		__m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+		for (unsigned i=b->row_ptr[br]; i<b->row_ptr[br+1]; i++) {
+			const double* v = b->val + (size_t)i*16;
+			const double* xb = x + (size_t)b->col[i]*4;
+
+			acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(v), _mm256_broadcast_sd(xb), acc0);
+			acc1 = _mm256_fmadd_pd(_mm256_loadu_pd(v+4), _mm256_broadcast_sd(xb+1), acc1);
+			acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(v+8), _mm256_broadcast_sd(xb+2), acc0);
+			acc1 = _mm256_fmadd_pd(_mm256_loadu_pd(v+12), _mm256_broadcast_sd(xb+3), acc1);
+		}
+
+		_mm256_storeu_pd(y + (size_t)br*4, _mm256_add_pd(acc0, acc1));
+	}
+}
+
+#endif
+
+static void bsr_rows(const bsr_t* b, const double* x, double* y, unsigned begin, unsigned end) {
+	unsigned bs = b->bs;
+	for (unsigned br=begin; br<end; br++) {
+		double* yb = y + (size_t)br*bs;
+		memset(yb, 0, sizeof(double)*bs);
+
+		for (unsigned i=b->row_ptr[br]; i<b->row_ptr[br+1]; i++) {
+			const double* v = b->val + (size_t)i*bs*bs;
+			const double* xb = x + (size_t)b->col[i]*bs;
+			for (unsigned j=0; j<bs; j++) {
+				for (unsigned k=0; k<bs; k++) yb[k] += v[j*bs + k]*xb[j];
+			}
+		}
+	}
+}
+
+typedef struct {
+	const bsr_t* b;
+	const double* x;
+	double* y;
+} bsr_job_t;
+
+static void bsr_part(void* arg, unsigned worker, unsigned begin, unsigned end) {
+	bsr_job_t* job = arg;
+	const bsr_t* b = job->b;
+
+#ifdef BSR_X86
+	if (b->simd) {
+		bsr_rows4_avx2(b, job->x, job->y, begin, end);
+		return;
+	}
+#endif
+
+	if (b->bs == 3) bsr_rows3(b, job->x, job->y, begin, end);
+	else if (b->bs == 4) bsr_rows4(b, job->x, job->y, begin, end);
+	else bsr_rows(b, job->x, job->y, begin, end);
+}
+
+//y = A x over block rows split across the pool, null for the calling thread. x and y may not alias
+void bsr_spmv(const bsr_t* b, pool_t* pool, const double* x, double* y) {
+	bsr_job_t job = {.b=b, .x=x, .y=y};
+	pool_run(pool, bsr_part, &job, b->nbrows, pool_grain(pool, b->nbrows));
+}
+
+//index and pointer bytes, what the blocks save over csr
+size_t bsr_index_bytes(const bsr_t* b) {
+	return sizeof(unsigned)*((size_t)b->nbrows + 1 + b->nnzb);
+}
+
+void bsr_free(bsr_t* b) {
+	drop(b->row_ptr);
+	drop(b->col);
+	drop(b->val);
+}
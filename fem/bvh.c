@@ -0,0 +1,731 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BVH_X86
+#include <immintrin.h>
+#endif
+
+#include "util.h"
+#include "pool.h"
+#include "cpu.h"
+#include "mesh.h"
+
+#define BVH_BINS 16
+#define BVH_LEAF 4 //triangles per leaf at most
+#define BVH_PACKET 8 //rays per packet at most
+#define BVH_DEPTH 64 //past this nodes split at the index median, keeping the traversal stack bounded
+#define BVH_STACK 128
+
+//left child is always the next node, so interior nodes only store the right one
+typedef struct {
+	float lo[3];
+	unsigned first; //interior: right child, leaf: first triangle in order
+	float hi[3];
+	unsigned count; //0 for interior nodes
+} bvh_node_t;
+
+typedef struct {
+	unsigned ntris;
+	unsigned nnodes;
+	bvh_node_t* nodes; //preorder
+	unsigned* order; //mesh triangle of each leaf position
+	float* tri; //per leaf position v0, v1-v0, v2-v0, what the intersection tests read
+	int simd; //avx2 packet kernels
+} bvh_t;
+
+typedef struct {
+	float t;
+	float u, v; //barycentric, of v1 and v2
+	unsigned tri; //mesh triangle, (unsigned)-1 for a miss
+} bvh_hit_t;
+
+//rays in structure of arrays, lanes past n are ignored. 4 ray packets run on the same 8 lanes half masked
+typedef struct {
+	unsigned n;
+	float org[3][BVH_PACKET];
+	float dir[3][BVH_PACKET];
+	float tmax[BVH_PACKET];
+} bvh_packet_t;
+
+typedef struct {
+	float lo[3], hi[3];
+} bvh_box_t;
+
+typedef struct {
+	unsigned begin, end; //in order
+	unsigned slot; //2(end-begin)-1 node slots from here belong to this subtree
+	unsigned depth;
+} bvh_task_t;
+
+//what the build partitions, box and triangle together so the sweeps over a node read contiguous memory
+typedef struct {
+	bvh_box_t box;
+	unsigned tri;
+} bvh_prim_t;
+
+typedef struct {
+	bvh_box_t box, cbox; //of triangles and of their centroids, doubled as lo+hi
+	bvh_box_t bins[3][BVH_BINS];
+	unsigned counts[3][BVH_BINS];
+} bvh_stats_t;
+
+typedef struct {
+	const mesh_t* mesh;
+	const unsigned* tris;
+	pool_t* pool;
+
+	bvh_prim_t* prims;
+	bvh_node_t* slots; //2n-1, subtrees reserve theirs by triangle range so they build independently
+
+	bvh_task_t* tasks; //subtrees left for the parallel phase
+	unsigned ntasks;
+	bvh_t* out;
+
+	//chunked statistics of one large node
+	bvh_task_t big;
+	bvh_box_t big_cbox;
+	bvh_stats_t* chunk;
+	unsigned pass; //0 bounds, 1 bins
+} bvh_build_t;
+
+//plain compares, fminf and fmaxf end up as libm calls for their nan rules. with a nan b wins, like minps
+static inline float bvh_min(float a, float b) {
+	return a < b ? a : b;
+}
+
+static inline float bvh_max(float a, float b) {
+	return a > b ? a : b;
+}
+
+static void bvh_box_empty(bvh_box_t* b) {
+	for (unsigned k=0; k<3; k++) {
+		b->lo[k] = INFINITY;
+		b->hi[k] = -INFINITY;
+	}
+}
+
+static void bvh_box_grow(bvh_box_t* b, const bvh_box_t* o) {
+	for (unsigned k=0; k<3; k++) {
+		b->lo[k] = bvh_min(b->lo[k], o->lo[k]);
+		b->hi[k] = bvh_max(b->hi[k], o->hi[k]);
+	}
+}
+
+static float bvh_box_area(const bvh_box_t* b) {
+	float d[3];
+	for (unsigned k=0; k<3; k++) d[k] = b->hi[k] > b->lo[k] ? b->hi[k] - b->lo[k] : 0;
+	return d[0]*d[1] + d[1]*d[2] + d[2]*d[0];
+}
+
+static void bvh_prims(void* arg, unsigned worker, unsigned begin, unsigned end) {
+	bvh_build_t* bb = arg;
+
+	for (unsigned t=begin; t<end; t++) {
+		bvh_box_t* b = &bb->prims[t].box;
+		bb->prims[t].tri = t;
+		bvh_box_empty(b);
+
+		for (unsigned i=0; i<3; i++) {
+			float p[3];
+			mesh_get(bb->mesh, bb->tris[(size_t)t*3 + i], p);
+			for (unsigned k=0; k<3; k++) {
+				b->lo[k] = bvh_min(b->lo[k], p[k]);
+				b->hi[k] = bvh_max(b->hi[k], p[k]);
+			}
+		}
+	}
+}
+
+//centroid bins along each axis as an offset and a scale, a flat axis puts everything in bin 0
+typedef struct {
+	float lo[3], scale[3];
+} bvh_binner_t;
+
+static bvh_binner_t bvh_binner(const bvh_box_t* cbox) {
+	bvh_binner_t b;
+	for (unsigned k=0; k<3; k++) {
+		float ext = cbox->hi[k] - cbox->lo[k];
+		b.lo[k] = cbox->lo[k];
+		b.scale[k] = ext > 0 ? BVH_BINS/ext : 0;
+	}
+
+	return b;
+}
+
+static unsigned bvh_bin_of(const bvh_binner_t* b, unsigned k, const bvh_box_t* box) {
+	int bin = (int)((box->lo[k] + box->hi[k] - b->lo[k])*b->scale[k]);
+	return bin < 0 ? 0 : bin >= BVH_BINS ? BVH_BINS-1 : (unsigned)bin;
+}
+
+static void bvh_stats_bounds(const bvh_build_t* bb, unsigned begin, unsigned end, bvh_stats_t* st) {
+	bvh_box_empty(&st->box);
+	bvh_box_empty(&st->cbox);
+
+	for (unsigned i=begin; i<end; i++) {
+		const bvh_box_t* b = &bb->prims[i].box;
+		bvh_box_grow(&st->box, b);
+
+		for (unsigned k=0; k<3; k++) {
+			float c = b->lo[k] + b->hi[k];
+			st->cbox.lo[k] = bvh_min(c, st->cbox.lo[k]);
+			st->cbox.hi[k] = bvh_max(c, st->cbox.hi[k]);
+		}
+	}
+}
+
+static void bvh_stats_bins(const bvh_build_t* bb, unsigned begin, unsigned end, const bvh_box_t* cbox, bvh_stats_t* st) {
+	memset(st->counts, 0, sizeof(st->counts));
+	for (unsigned k=0; k<3; k++) {
+		for (unsigned j=0; j<BVH_BINS; j++) bvh_box_empty(&st->bins[k][j]);
+	}
+
+	bvh_binner_t bn = bvh_binner(cbox);
+	for (unsigned i=begin; i<end; i++) {
+		const bvh_box_t* b = &bb->prims[i].box;
+		for (unsigned k=0; k<3; k++) {
+			unsigned j = bvh_bin_of(&bn, k, b);
+			st->counts[k][j]++;
+			bvh_box_grow(&st->bins[k][j], b);
+		}
+	}
+}
+
+//fixed chunks, min, max and counts merge the same in any order so the result does not depend on the pool
+#define BVH_CHUNKS 64
+
+static void bvh_chunk_range(const bvh_task_t* t, unsigned c, unsigned* begin, unsigned* end) {
+	unsigned n = t->end - t->begin;
+	*begin = t->begin + (unsigned)((uint64_t)n*c/BVH_CHUNKS);
+	*end = t->begin + (unsigned)((uint64_t)n*(c+1)/BVH_CHUNKS);
+}
+
+static void bvh_chunk_stats(void* arg, unsigned worker, unsigned begin, unsigned end) {
+	bvh_build_t* bb = arg;
+
+	for (unsigned c=begin; c<end; c++) {
+		unsigned lo, hi;
+		bvh_chunk_range(&bb->big, c, &lo, &hi);
+		if (bb->pass == 0) bvh_stats_bounds(bb, lo, hi, &bb->chunk[c]);
+		else bvh_stats_bins(bb, lo, hi, &bb->big_cbox, &bb->chunk[c]);
+	}
+}
+
+//the serial versions over the pool, for nodes near the root
+static void bvh_stats(bvh_build_t* bb, const bvh_task_t* task, bvh_stats_t* st) {
+	bb->big = *task;
+	bb->pass = 0;
+	pool_run(bb->pool, bvh_chunk_stats, bb, BVH_CHUNKS, 1);
+
+	for (unsigned c=1; c<BVH_CHUNKS; c++) {
+		bvh_box_grow(&bb->chunk[0].box, &bb->chunk[c].box);
+		bvh_box_grow(&bb->chunk[0].cbox, &bb->chunk[c].cbox);
+	}
+
+	st->box = bb->chunk[0].box;
+	st->cbox = bb->big_cbox = bb->chunk[0].cbox;
+
+	bb->pass = 1;
+	pool_run(bb->pool, bvh_chunk_stats, bb, BVH_CHUNKS, 1);
+
+	memset(st->counts, 0, sizeof(st->counts));
+	for (unsigned k=0; k<3; k++) {
+		for (unsigned j=0; j<BVH_BINS; j++) {
+			bvh_box_empty(&st->bins[k][j]);
+			for (unsigned c=0; c<BVH_CHUNKS; c++) {
+				st->counts[k][j] += bb->chunk[c].counts[k][j];
+				bvh_box_grow(&st->bins[k][j], &bb->chunk[c].bins[k][j]);
+			}
+		}
+	}
+}
+
+//fills the task's node and returns where its range splits, or 0 for a leaf
+static unsigned bvh_split(bvh_build_t* bb, const bvh_task_t* task, int parallel) {
+	unsigned n = task->end - task->begin;
+	bvh_node_t* node = &bb->slots[task->slot];
+
+	bvh_stats_t st;
+	if (parallel) bvh_stats(bb, task, &st);
+	else bvh_stats_bounds(bb, task->begin, task->end, &st);
+
+	memcpy(node->lo, st.box.lo, sizeof(node->lo));
+	memcpy(node->hi, st.box.hi, sizeof(node->hi));
+
+	if (n <= BVH_LEAF) {
+		node->first = task->begin;
+		node->count = n;
+		return 0;
+	}
+
+	if (!parallel) bvh_stats_bins(bb, task->begin, task->end, &st.cbox, &st);
+
+	//sweep each axis for the cheapest plane between bins, areas times counts
+	float best = INFINITY;
+	unsigned best_axis = 0, best_bin = 0;
+	if (task->depth < BVH_DEPTH) {
+		for (unsigned k=0; k<3; k++) {
+			float right_cost[BVH_BINS];
+			bvh_box_t acc;
+			bvh_box_empty(&acc);
+
+			unsigned cnt = 0;
+			for (unsigned j=BVH_BINS; j-- > 1;) {
+				bvh_box_grow(&acc, &st.bins[k][j]);
+				cnt += st.counts[k][j];
+				right_cost[j] = cnt ? bvh_box_area(&acc)*(float)cnt : INFINITY;
+			}
+
+			bvh_box_empty(&acc);
+			cnt = 0;
+			for (unsigned j=1; j<BVH_BINS; j++) {
+				bvh_box_grow(&acc, &st.bins[k][j-1]);
+				cnt += st.counts[k][j-1];
+				if (!cnt || cnt == n) continue;
+
+				float cost = bvh_box_area(&acc)*(float)cnt + right_cost[j];
+				if (cost < best) {
+					best = cost;
+					best_axis = k;
+					best_bin = j;
+				}
+			}
+		}
+	}
+
+	unsigned mid;
+	if (best < INFINITY) {
+		bvh_prim_t* prims = bb->prims;
+		bvh_binner_t bn = bvh_binner(&st.cbox);
+		unsigned i = task->begin, j = task->end;
+		while (i < j) {
+			if (bvh_bin_of(&bn, best_axis, &prims[i].box) < best_bin) {
+				i++;
+			} else {
+				bvh_prim_t t = prims[i];
+				prims[i] = prims[--j];
+				prims[j] = t;
+			}
+		}
+
+		mid = i;
+	} else {
+		//every centroid in one bin, or too deep: halves by index, still a valid tree
+		mid = task->begin + n/2;
+	}
+
+	node->count = 0;
+	node->first = task->slot + 2*(mid - task->begin);
+	return mid;
+}
+
+static void bvh_children(const bvh_task_t* task, unsigned mid, bvh_task_t* left, bvh_task_t* right) {
+	*left = (bvh_task_t){.begin=task->begin, .end=mid, .slot=task->slot+1, .depth=task->depth+1};
+	*right = (bvh_task_t){.begin=mid, .end=task->end, .slot=task->slot + 2*(mid - task->begin), .depth=task->depth+1};
+}
+
+static void bvh_subtrees(void* arg, unsigned worker, unsigned begin, unsigned end) {
+	bvh_build_t* bb = arg;
+
+	for (unsigned s=begin; s<end; s++) {
+		bvh_task_t stack[BVH_STACK];
+		unsigned sp = 0;
+		stack[sp++] = bb->tasks[s];
+
+		while (sp) {
+			bvh_task_t task = stack[--sp];
+			unsigned mid = bvh_split(bb, &task, 0);
+			if (mid) {
+				bvh_children(&task, mid, &stack[sp], &stack[sp+1]);
+				sp += 2;
+			}
+		}
+	}
+}
+
+static int bvh_task_cmp(const void* a, const void* b) {
+	unsigned x = ((const bvh_task_t*)a)->end - ((const bvh_task_t*)a)->begin;
+	unsigned y = ((const bvh_task_t*)b)->end - ((const bvh_task_t*)b)->begin;
+	return (x < y) - (x > y);
+}
+
+static void bvh_tri_data(void* arg, unsigned worker, unsigned begin, unsigned end) {
+	bvh_build_t* bb = arg;
+	bvh_t* bvh = bb->out;
+
+	for (unsigned i=begin; i<end; i++) {
+		const unsigned* tri = bb->tris + (size_t)bvh->order[i]*3;
+		float p0[3], p1[3], p2[3];
+		mesh_get(bb->mesh, tri[0], p0);
+		mesh_get(bb->mesh, tri[1], p1);
+		mesh_get(bb->mesh, tri[2], p2);
+
+		float* out = bvh->tri + (size_t)i*9;
+		for (unsigned k=0; k<3; k++) {
+			out[k] = p0[k];
+			out[3+k] = p1[k] - p0[k];
+			out[6+k] = p2[k] - p0[k];
+		}
+	}
+}
+
+//tris 3 indices each into mesh. the top of the tree is split with binning spread over the pool, the
+//subtrees below are built one per worker, and the result is the same for any pool
+bvh_t bvh_new(const mesh_t* mesh, const unsigned* tris, unsigned ntris, pool_t* pool) {
+	bvh_t bvh = {.ntris=ntris};
+	bvh.simd = cpu_has_avx2();
+	unsigned n = ntris ? ntris : 1;
+
+	bvh_build_t bb = {.mesh=mesh, .tris=tris, .pool=pool};
+	bb.prims = heap(sizeof(bvh_prim_t)*n);
+	bb.slots = heap(sizeof(bvh_node_t)*(2*n-1));
+	bb.chunk = heap(sizeof(bvh_stats_t)*BVH_CHUNKS);
+	bb.tasks = heap(sizeof(bvh_task_t)*n);
+
+	pool_run(pool, bvh_prims, &bb, ntris, pool_grain(pool, ntris));
+
+	//nodes above the cutoff split here, breadth first, the rest go to the pool as whole subtrees
+	unsigned cutoff = ntris/(8*pool_threads(pool));
+	if (cutoff < 4096) cutoff = 4096;
+
+	bvh_task_t* queue = heap(sizeof(bvh_task_t)*n);
+	unsigned head = 0, tail = 0;
+	queue[tail++] = (bvh_task_t){.begin=0, .end=ntris, .slot=0};
+
+	while (head < tail) {
+		bvh_task_t task = queue[head++];
+		if (task.end - task.begin <= cutoff) {
+			bb.tasks[bb.ntasks++] = task;
+			continue;
+		}
+
+		unsigned mid = bvh_split(&bb, &task, 1);
+		if (mid) {
+			bvh_children(&task, mid, &queue[tail], &queue[tail+1]);
+			tail += 2;
+		}
+	}
+
+	drop(queue);
+
+	qsort(bb.tasks, bb.ntasks, sizeof(bvh_task_t), bvh_task_cmp);
+	pool_run(pool, bvh_subtrees, &bb, bb.ntasks, 1);
+
+	//compact the reserved slots into preorder, left children land right after their parent
+	bvh.nodes = heap(sizeof(bvh_node_t)*(2*n-1));
+	unsigned stack[BVH_STACK], patch[BVH_STACK], sp = 0;
+	stack[sp] = 0;
+	patch[sp++] = (unsigned)-1;
+
+	while (sp) {
+		sp--;
+		unsigned slot = stack[sp], at = bvh.nnodes++;
+		if (patch[sp] != (unsigned)-1) bvh.nodes[patch[sp]].first = at;
+
+		bvh_node_t node = bb.slots[slot];
+		bvh.nodes[at] = node;
+
+		if (!node.count && ntris) {
+			stack[sp] = node.first;
+			patch[sp++] = at;
+			stack[sp] = slot+1;
+			patch[sp++] = (unsigned)-1;
+		}
+	}
+
+	bvh.nodes = resize(bvh.nodes, sizeof(bvh_node_t)*bvh.nnodes);
+	bvh.order = heap(sizeof(unsigned)*n);
+	for (unsigned i=0; i<ntris; i++) bvh.order[i] = bb.prims[i].tri;
+
+	bvh.tri = heap(sizeof(float)*9*n);
+	bb.out = &bvh;
+	pool_run(pool, bvh_tri_data, &bb, ntris, pool_grain(pool, ntris));
+
+	drop(bb.prims);
+	drop(bb.slots);
+	drop(bb.chunk);
+	drop(bb.tasks);
+	return bvh;
+}
+
+//entry distance into the node's box, infinity on a miss or past tmax
+static float bvh_box_hit(const bvh_node_t* node, const float org[3], const float inv[3], float tmax) {
+	float t0 = 0, t1 = tmax;
+	for (unsigned k=0; k<3; k++) {
+		float a = (node->lo[k] - org[k])*inv[k];
+		float b = (node->hi[k] - org[k])*inv[k];
+		t0 = bvh_max(bvh_min(a, b), t0);
+		t1 = bvh_min(bvh_max(a, b), t1);
+	}
+
+	return t0 <= t1 ? t0 : INFINITY;
+}
+
+//moller trumbore against leaf position i, hit only moves closer
+static void bvh_tri_hit(const bvh_t* bvh, unsigned i, const float org[3], const float dir[3], bvh_hit_t* hit) {
+	const float* v0 = bvh->tri + (size_t)i*9;
+	const float* e1 = v0 + 3;
+	const float* e2 = v0 + 6;
+
+	float p[3] = {dir[1]*e2[2] - dir[2]*e2[1], dir[2]*e2[0] - dir[0]*e2[2], dir[0]*e2[1] - dir[1]*e2[0]};
+	float det = e1[0]*p[0] + e1[1]*p[1] + e1[2]*p[2];
+	if (det == 0) return;
+
+	float inv_det = 1.0f/det;
+	float s[3] = {org[0] - v0[0], org[1] - v0[1], org[2] - v0[2]};
+	float u = (s[0]*p[0] + s[1]*p[1] + s[2]*p[2])*inv_det;
+	if (u < 0 || u > 1) return;
+
+	float q[3] = {s[1]*e1[2] - s[2]*e1[1], s[2]*e1[0] - s[0]*e1[2], s[0]*e1[1] - s[1]*e1[0]};
+	float v = (dir[0]*q[0] + dir[1]*q[1] + dir[2]*q[2])*inv_det;
+	if (v < 0 || u + v > 1) return;
+
+	float t = (e2[0]*q[0] + e2[1]*q[1] + e2[2]*q[2])*inv_det;
+	if (t > 0 && t < hit->t) *hit = (bvh_hit_t){.t=t, .u=u, .v=v, .tri=bvh->order[i]};
+}
+
+//closest hit along org + t dir for 0 < t < tmax, 1 if there is one
+int bvh_intersect(const bvh_t* bvh, const float org[3], const float dir[3], float tmax, bvh_hit_t* hit) {
+	*hit = (bvh_hit_t){.t=tmax, .tri=(unsigned)-1};
+	if (!bvh->ntris) return 0;
+
+	float inv[3] = {1.0f/dir[0], 1.0f/dir[1], 1.0f/dir[2]};
+	unsigned stack[BVH_STACK], sp = 0;
+	float dist[BVH_STACK];
+	unsigned node = 0;
+	if (bvh_box_hit(&bvh->nodes[0], org, inv, hit->t) == INFINITY) return 0;
+
+	while (1) {
+		const bvh_node_t* nd = &bvh->nodes[node];
+
+		if (nd->count) {
+			for (unsigned i=nd->first; i<nd->first+nd->count; i++) bvh_tri_hit(bvh, i, org, dir, hit);
+		} else {
+			unsigned l = node+1, r = nd->first;
+			float tl = bvh_box_hit(&bvh->nodes[l], org, inv, hit->t);
+			float tr = bvh_box_hit(&bvh->nodes[r], org, inv, hit->t);
+
+			if (tl != INFINITY && tr != INFINITY) {
+				//nearer first, the far one is revisited only if the hit so far lies behind its entry
+				dist[sp] = tl <= tr ? tr : tl;
+				stack[sp++] = tl <= tr ? r : l;
+				node = tl <= tr ? l : r;
+				continue;
+			}
+
+			if (tl != INFINITY) { node = l; continue; }
+			if (tr != INFINITY) { node = r; continue; }
+		}
+
+		while (sp && dist[sp-1] > hit->t) sp--;
+		if (!sp) break;
+		node = stack[--sp];
+	}
+
+	return hit->tri != (unsigned)-1;
+}
+
+//per lane state of a packet traversal
+typedef struct {
+	float org[3][BVH_PACKET];
+	float dir[3][BVH_PACKET];
+	float inv[3][BVH_PACKET];
+	float t[BVH_PACKET];
+	float u[BVH_PACKET];
+	float v[BVH_PACKET];
+	unsigned tri[BVH_PACKET];
+} bvh_lanes_t;
+
+//lanes of mask entering the box before their current hit
+static unsigned bvh_box8(const bvh_node_t* node, const bvh_lanes_t* l, unsigned mask) {
+	unsigned hit = 0;
+
+	for (unsigned j=0; j<BVH_PACKET; j++) {
+		if (!(mask>>j & 1)) continue;
+
+		float t0 = 0, t1 = l->t[j];
+		for (unsigned k=0; k<3; k++) {
+			float a = (node->lo[k] - l->org[k][j])*l->inv[k][j];
+			float b = (node->hi[k] - l->org[k][j])*l->inv[k][j];
+			t0 = bvh_max(bvh_min(a, b), t0);
+			t1 = bvh_min(bvh_max(a, b), t1);
+		}
+
+		if (t0 <= t1) hit |= 1u<<j;
+	}
+
+	return hit;
+}
+
+static void bvh_tri8(const bvh_t* bvh, unsigned i, bvh_lanes_t* l, unsigned mask) {
+	for (unsigned j=0; j<BVH_PACKET; j++) {
+		if (!(mask>>j & 1)) continue;
+
+		float org[3] = {l->org[0][j], l->org[1][j], l->org[2][j]};
+		float dir[3] = {l->dir[0][j], l->dir[1][j], l->dir[2][j]};
+		bvh_hit_t hit = {.t=l->t[j], .tri=l->tri[j]};
+		bvh_tri_hit(bvh, i, org, dir, &hit);
+
+		l->t[j] = hit.t;
+		l->u[j] = hit.u;
+		l->v[j] = hit.v;
+		l->tri[j] = hit.tri;
+	}
+}
+
+#ifdef BVH_X86
+
+//eight slab tests at once. min and max return their second operand on a nan, which keeps 0 * inf out
+__attribute__((target("avx2,fma")))
+static unsigned bvh_box8_avx2(const bvh_node_t* node, const bvh_lanes_t* l, unsigned mask) {
+	__m256 t0 = _mm256_setzero_ps(), t1 = _mm256_loadu_ps(l->t);
+
+	for (unsigned k=0; k<3; k++) {
+		__m256 org = _mm256_loadu_ps(l->org[k]), inv = _mm256_loadu_ps(l->inv[k]);
+		__m256 a = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node->lo[k]), org), inv);
+		__m256 b = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node->hi[k]), org), inv);
+		t0 = _mm256_max_ps(_mm256_min_ps(a, b), t0);
+		t1 = _mm256_min_ps(_mm256_max_ps(a, b), t1);
+	}
+
+	return (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ)) & mask;
+}
+
+//one triangle broadcast against eight rays
+__attribute__((target("avx2,fma")))
+static void bvh_tri8_avx2(const bvh_t* bvh, unsigned i, bvh_lanes_t* l, unsigned mask) {
+	const float* tri = bvh->tri + (size_t)i*9;
+	__m256 v0[3], e1[3], e2[3], d[3], s[3];
+	for (unsigned k=0; k<3; k++) {
+		v0[k] = _mm256_set1_ps(tri[k]);
+		e1[k] = _mm256_set1_ps(tri[3+k]);
+		e2[k] = _mm256_set1_ps(tri[6+k]);
+		d[k] = _mm256_loadu_ps(l->dir[k]);
+		s[k] = _mm256_sub_ps(_mm256_loadu_ps(l->org[k]), v0[k]);
+	}
+
+	__m256 p0 = _mm256_fmsub_ps(d[1], e2[2], _mm256_mul_ps(d[2], e2[1]));
+	__m256 p1 = _mm256_fmsub_ps(d[2], e2[0], _mm256_mul_ps(d[0], e2[2]));
+	__m256 p2 = _mm256_fmsub_ps(d[0], e2[1], _mm256_mul_ps(d[1], e2[0]));
+	__m256 det = _mm256_fmadd_ps(e1[0], p0, _mm256_fmadd_ps(e1[1], p1, _mm256_mul_ps(e1[2], p2)));
+	__m256 inv_det = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+
+	__m256 u = _mm256_mul_ps(_mm256_fmadd_ps(s[0], p0, _mm256_fmadd_ps(s[1], p1, _mm256_mul_ps(s[2], p2))), inv_det);
+
+	__m256 q0 = _mm256_fmsub_ps(s[1], e1[2], _mm256_mul_ps(s[2], e1[1]));
+	__m256 q1 = _mm256_fmsub_ps(s[2], e1[0], _mm256_mul_ps(s[0], e1[2]));
+	__m256 q2 = _mm256_fmsub_ps(s[0], e1[1], _mm256_mul_ps(s[1], e1[0]));
+	__m256 v = _mm256_mul_ps(_mm256_fmadd_ps(d[0], q0, _mm256_fmadd_ps(d[1], q1, _mm256_mul_ps(d[2], q2))), inv_det);
+	__m256 t = _mm256_mul_ps(_mm256_fmadd_ps(e2[0], q0, _mm256_fmadd_ps(e2[1], q1, _mm256_mul_ps(e2[2], q2))), inv_det);
+
+	__m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f), tcur = _mm256_loadu_ps(l->t);
+	__m256 ok = _mm256_cmp_ps(det, zero, _CMP_NEQ_OQ);
+	ok = _mm256_and_ps(ok, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+	ok = _mm256_and_ps(ok, _mm256_cmp_ps(u, one, _CMP_LE_OQ));
+	ok = _mm256_and_ps(ok, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+	ok = _mm256_and_ps(ok, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+	ok = _mm256_and_ps(ok, _mm256_cmp_ps(t, zero, _CMP_GT_OQ));
+	ok = _mm256_and_ps(ok, _mm256_cmp_ps(t, tcur, _CMP_LT_OQ));
+
+	//only the lanes whose rays entered the box, as in bvh_tri8, so t never moves without u, v and tri
+	__m256i bit = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+	__m256i live = _mm256_cmpgt_epi32(_mm256_and_si256(_mm256_set1_epi32((int)mask), bit), _mm256_setzero_si256());
+	ok = _mm256_and_ps(ok, _mm256_castsi256_ps(live));
+
+	unsigned hit = (unsigned)_mm256_movemask_ps(ok);
+	if (!hit) return;
+
+	_mm256_storeu_ps(l->t, _mm256_blendv_ps(tcur, t, ok));
+	float uu[BVH_PACKET], vv[BVH_PACKET];
+	_mm256_storeu_ps(uu, u);
+	_mm256_storeu_ps(vv, v);
+	for (unsigned j=0; j<BVH_PACKET; j++) {
+		if (!(hit>>j & 1)) continue;
+		l->u[j] = uu[j];
+		l->v[j] = vv[j];
+		l->tri[j] = bvh->order[i];
+	}
+}
+
+#endif
+
+//closest hits of up to BVH_PACKET rays, traversing the tree once for all of them. pays off for coherent rays
+//(neighbouring pixels, one origin), scattered ones are better served by bvh_intersect one at a time
+void bvh_intersect_packet(const bvh_t* bvh, const bvh_packet_t* pk, bvh_hit_t* hits) {
+	bvh_lanes_t l;
+	unsigned live = pk->n >= BVH_PACKET ? (1u<<BVH_PACKET) - 1 : (1u<<pk->n) - 1;
+
+	for (unsigned j=0; j<BVH_PACKET; j++) {
+		int on = live>>j & 1;
+		for (unsigned k=0; k<3; k++) {
+			l.org[k][j] = on ? pk->org[k][j] : 0;
+			l.dir[k][j] = on ? pk->dir[k][j] : 1;
+			l.inv[k][j] = 1.0f/l.dir[k][j];
+		}
+
+		l.t[j] = on ? pk->tmax[j] : -1;
+		l.u[j] = l.v[j] = 0;
+		l.tri[j] = (unsigned)-1;
+	}
+
+	unsigned stack[BVH_STACK], sp = 0;
+	if (bvh->ntris) stack[sp++] = 0;
+
+	while (sp) {
+		unsigned node = stack[--sp];
+		const bvh_node_t* nd = &bvh->nodes[node];
+
+		unsigned mask;
+#ifdef BVH_X86
+		if (bvh->simd) mask = bvh_box8_avx2(nd, &l, live);
+		else
+#endif
+		mask = bvh_box8(nd, &l, live);
+		if (!mask) continue;
+
+		if (nd->count) {
+			for (unsigned i=nd->first; i<nd->first+nd->count; i++) {
+#ifdef BVH_X86
+				if (bvh->simd) {
+					bvh_tri8_avx2(bvh, i, &l, mask);
+					continue;
+				}
+#endif
+				bvh_tri8(bvh, i, &l, mask);
+			}
+
+			continue;
+		}
+
+		//children in the order the first live ray meets them along the node's widest axis
+		unsigned axis = 0, first = (unsigned)__builtin_ctz(mask);
+		for (unsigned k=1; k<3; k++) {
+			if (nd->hi[k] - nd->lo[k] > nd->hi[axis] - nd->lo[axis]) axis = k;
+		}
+
+		if (l.dir[axis][first] < 0) {
+			stack[sp++] = node+1;
+			stack[sp++] = nd->first;
+		} else {
+			stack[sp++] = nd->first;
+			stack[sp++] = node+1;
+		}
+	}
+
+	for (unsigned j=0; j<pk->n && j<BVH_PACKET; j++) {
+		hits[j] = (bvh_hit_t){.t=l.t[j], .u=l.u[j], .v=l.v[j], .tri=l.tri[j]};
+	}
+}
+
+//node and triangle bytes, the index array included
+size_t bvh_bytes(const bvh_t* bvh) {
+	return sizeof(bvh_node_t)*bvh->nnodes + (sizeof(unsigned) + sizeof(float)*9)*bvh->ntris;
+}
+
+void bvh_free(bvh_t* bvh) {
+	drop(bvh->nodes);
+	drop(bvh->order);
+	drop(bvh->tri);
+}
@@ -0,0 +1,430 @@
+#include <math.h>
+#include <string.h>
+
+#include "util.h"
+#include "sparsemat.h"
+#include "reorder.h"
+
+typedef enum {
+	chol_llt, //a = l l^T, a positive definite
+	chol_ldlt //a = l d l^T with unit l, any symmetric a whose leading minors are nonsingular
+} chol_kind;
+
+typedef enum {
+	chol_natural,
+	chol_rcm,
+	chol_nd //nested dissection, least fill on mesh matrices
+} chol_order;
+
+//sparse direct solver for symmetric a. chol_new does the symbolic work once per pattern, chol_factor the
+//numeric work once per set of values, and chol_solve any number of right hand sides against that
+//columns of l with the same structure below them are grouped into supernodes, stored as dense column major
+//blocks, so factoring and solving run over contiguous columns instead of chasing indices per entry
+typedef struct {
+	chol_kind kind;
+	unsigned n;
+	reorder_t perm; //fill reducing order followed by a postorder of the elimination tree
+	unsigned* parent; //elimination tree of the permuted matrix, -1 at roots
+
+	unsigned nsuper;
+	unsigned* super; //nsuper+1, first column of each supernode
+	unsigned* snode; //column -> supernode
+	unsigned* row_ptr; //nsuper+1, into rows
+	unsigned* rows; //per supernode its own columns, then the rows below them in increasing order
+
+	size_t* val_ptr; //nsuper+1, into val
+	double* val; //per supernode rows*cols, column major with the row count as leading dimension
+	double* d; //ldlt: the diagonal
+	size_t nnz; //stored entries of l, upper half of the diagonal blocks included
+
+	double* work; //solve: permuted right hand sides, interleaved
+	unsigned work_rhs;
+} chol_t;
+
+//liu's algorithm, ancestors path compressed through anc. b has both triangles
+static void chol_etree(const csr_t* b, unsigned* parent, unsigned* anc) {
+	for (unsigned k=0; k<b->nrows; k++) {
+		parent[k] = (unsigned)-1;
+		anc[k] = (unsigned)-1;
+
+		for (unsigned p=b->row_ptr[k]; p<b->row_ptr[k+1] && b->col[p] < k; p++) {
+			unsigned i = b->col[p];
+			while (i != (unsigned)-1 && i < k) {
+				unsigned next = anc[i];
+				anc[i] = k;
+				if (next == (unsigned)-1) parent[i] = k;
+				i = next;
+			}
+		}
+	}
+}
+
+//children before parents and every subtree contiguous, which leaves fill unchanged and lines up supernodes
+static void chol_postorder(const unsigned* parent, unsigned n, unsigned* post) {
+	unsigned* head = heap(sizeof(unsigned)*(n ? n : 1));
+	unsigned* next = heap(sizeof(unsigned)*(n ? n : 1));
+	unsigned* stack = heap(sizeof(unsigned)*(n ? n : 1));
+	memset(head, 0xff, sizeof(unsigned)*n);
+
+	//pushed in reverse so children come out in increasing order
+	for (unsigned j=n; j-- > 0;) {
+		if (parent[j] == (unsigned)-1) continue;
+		next[j] = head[parent[j]];
+		head[parent[j]] = j;
+	}
+
+	unsigned k = 0;
+	for (unsigned r=0; r<n; r++) {
+		if (parent[r] != (unsigned)-1) continue;
+
+		unsigned top = 0;
+		stack[top++] = r;
+		while (top) {
+			unsigned v = stack[top-1];
+			unsigned c = head[v];
+			if (c == (unsigned)-1) {
+				top--;
+				post[k++] = v;
+			} else {
+				head[v] = next[c];
+				stack[top++] = c;
+			}
+		}
+	}
+
+	drop(head);
+	drop(next);
+	drop(stack);
+}
+
+//row subtree of k: every column j < k with l_kj nonzero, each once, into out. mark[j] == k once visited
+static unsigned chol_row(const csr_t* b, const unsigned* parent, unsigned* mark, unsigned k, unsigned* out) {
+	unsigned cnt = 0;
+	mark[k] = k;
+
+	for (unsigned p=b->row_ptr[k]; p<b->row_ptr[k+1] && b->col[p] < k; p++) {
+		for (unsigned j=b->col[p]; mark[j] != k; j=parent[j]) {
+			mark[j] = k;
+			out[cnt++] = j;
+		}
+	}
+
+	return cnt;
+}
+
+//a only needs its pattern here, both triangles of it. any later chol_factor has to use the same pattern
+chol_t chol_new(const csr_t* a, chol_kind kind, chol_order order) {
+	unsigned n = a->nrows;
+	chol_t c = {.kind=kind, .n=n};
+
+	reorder_graph_t g = reorder_graph_csr(a);
+	reorder_t fill = order == chol_rcm ? reorder_rcm(&g) : order == chol_nd ? reorder_nd(&g) : reorder_identity(n);
+	reorder_graph_free(&g);
+
+	unsigned* anc = heap(sizeof(unsigned)*(n ? n : 1));
+	unsigned* post = heap(sizeof(unsigned)*(n ? n : 1));
+	c.parent = heap(sizeof(unsigned)*(n ? n : 1));
+
+	csr_t b = reorder_csr(a, &fill);
+	chol_etree(&b, c.parent, anc);
+	chol_postorder(c.parent, n, post);
+	csr_free(&b);
+
+	c.perm = reorder_identity(n);
+	for (unsigned i=0; i<n; i++) c.perm.perm[i] = fill.perm[post[i]];
+	for (unsigned i=0; i<n; i++) c.perm.iperm[c.perm.perm[i]] = i;
+	reorder_free(&fill);
+	drop(post);
+
+	b = reorder_csr(a, &c.perm);
+	chol_etree(&b, c.parent, anc);
+
+	//column counts below the diagonal, one row subtree per row
+	unsigned* mark = anc;
+	unsigned* sub = heap(sizeof(unsigned)*(n ? n : 1));
+	unsigned* cnt = heap(sizeof(unsigned)*(n ? n : 1));
+	memset(cnt, 0, sizeof(unsigned)*n);
+	memset(mark, 0xff, sizeof(unsigned)*n);
+
+	for (unsigned k=0; k<n; k++) {
+		unsigned len = chol_row(&b, c.parent, mark, k, sub);
+		for (unsigned i=0; i<len; i++) cnt[sub[i]]++;
+	}
+
+	//j joins j+1's supernode when it is j+1's child and its structure is j+1's plus j+1 itself
+	c.snode = heap(sizeof(unsigned)*(n ? n : 1));
+	c.super = heap(sizeof(unsigned)*(n+1));
+	for (unsigned j=0; j<n; j++) {
+		if (j == 0 || c.parent[j-1] != j || cnt[j-1] != cnt[j] + 1) c.super[c.nsuper++] = j;
+		c.snode[j] = c.nsuper-1;
+	}
+
+	c.super[c.nsuper] = n;
+	c.super = resize(c.super, sizeof(unsigned)*(c.nsuper+1));
+
+	//rows below each supernode from the same row subtrees, in increasing order since k increases
+	c.row_ptr = heap(sizeof(unsigned)*(c.nsuper+1));
+	unsigned* last = heap(sizeof(unsigned)*(c.nsuper ? c.nsuper : 1));
+	memset(last, 0xff, sizeof(unsigned)*c.nsuper);
+	memset(mark, 0xff, sizeof(unsigned)*n);
+
+	for (unsigned s=0; s<c.nsuper; s++) c.row_ptr[s+1] = c.super[s+1] - c.super[s];
+	for (unsigned k=0; k<n; k++) {
+		unsigned len = chol_row(&b, c.parent, mark, k, sub);
+		for (unsigned i=0; i<len; i++) {
+			unsigned s = c.snode[sub[i]];
+			if (s != c.snode[k] && last[s] != k) {
+				last[s] = k;
+				c.row_ptr[s+1]++;
+			}
+		}
+	}
+
+	c.row_ptr[0] = 0;
+	c.val_ptr = heap(sizeof(size_t)*(c.nsuper+1));
+	c.val_ptr[0] = 0;
+	for (unsigned s=0; s<c.nsuper; s++) {
+		unsigned nr = c.row_ptr[s+1];
+		c.row_ptr[s+1] += c.row_ptr[s];
+		c.val_ptr[s+1] = c.val_ptr[s] + (size_t)nr*(c.super[s+1] - c.super[s]);
+	}
+
+	c.rows = heap(sizeof(unsigned)*(c.row_ptr[c.nsuper] ? c.row_ptr[c.nsuper] : 1));
+	unsigned* fill_at = heap(sizeof(unsigned)*(c.nsuper ? c.nsuper : 1));
+	for (unsigned s=0; s<c.nsuper; s++) {
+		fill_at[s] = c.row_ptr[s];
+		for (unsigned j=c.super[s]; j<c.super[s+1]; j++) c.rows[fill_at[s]++] = j;
+	}
+
+	memset(last, 0xff, sizeof(unsigned)*c.nsuper);
+	memset(mark, 0xff, sizeof(unsigned)*n);
+	for (unsigned k=0; k<n; k++) {
+		unsigned len = chol_row(&b, c.parent, mark, k, sub);
+		for (unsigned i=0; i<len; i++) {
+			unsigned s = c.snode[sub[i]];
+			if (s != c.snode[k] && last[s] != k) {
+				last[s] = k;
+				c.rows[fill_at[s]++] = k;
+			}
+		}
+	}
+
+	c.nnz = c.val_ptr[c.nsuper];
+	c.val = heap(sizeof(double)*(c.nnz ? c.nnz : 1));
+	if (kind == chol_ldlt) c.d = heap(sizeof(double)*(n ? n : 1));
+
+	csr_free(&b);
+	drop(anc);
+	drop(sub);
+	drop(cnt);
+	drop(last);
+	drop(fill_at);
+	return c;
+}
+
+//factors the values of a, which needs the pattern chol_new saw. 0 on a non positive (llt) or zero (ldlt) pivot
+//right looking over supernodes: each one is factored as a dense panel, then its outer product is pushed
+//into the supernodes it touches, one target column at a time through a dense buffer
+int chol_factor(chol_t* c, const csr_t* a) {
+	unsigned n = c->n;
+	csr_t b = reorder_csr(a, &c->perm);
+
+	unsigned* rel = heap(sizeof(unsigned)*(n ? n : 1));
+	double* tmp = heap(sizeof(double)*(n ? n : 1));
+	memset(c->val, 0, sizeof(double)*c->nnz);
+
+	//lower triangle of b into the blocks, column j's entries are row j's from the diagonal on
+	for (unsigned s=0; s<c->nsuper; s++) {
+		unsigned f = c->super[s], w = c->super[s+1] - f;
+		unsigned* rows = c->rows + c->row_ptr[s];
+		unsigned nr = c->row_ptr[s+1] - c->row_ptr[s];
+		for (unsigned i=0; i<nr; i++) rel[rows[i]] = i;
+
+		for (unsigned jc=0; jc<w; jc++) {
+			double* col = c->val + c->val_ptr[s] + (size_t)jc*nr;
+			unsigned j = f + jc;
+			for (unsigned p=b.row_ptr[j]; p<b.row_ptr[j+1]; p++) {
+				if (b.col[p] >= j) col[rel[b.col[p]]] += b.val[p];
+			}
+		}
+	}
+
+	int ok = 1;
+	for (unsigned s=0; s<c->nsuper && ok; s++) {
+		unsigned f = c->super[s], w = c->super[s+1] - f;
+		unsigned* rows = c->rows + c->row_ptr[s];
+		unsigned nr = c->row_ptr[s+1] - c->row_ptr[s];
+		double* l = c->val + c->val_ptr[s];
+
+		//dense panel: the diagonal block and everything under it, column by column
+		for (unsigned j=0; j<w; j++) {
+			double* lj = l + (size_t)j*nr;
+			double piv = lj[j];
+
+			if (c->kind == chol_llt) {
+				if (!(piv > 0)) {
+					ok = 0;
+					break;
+				}
+
+				piv = lj[j] = sqrt(piv);
+			} else {
+				if (piv == 0 || !isfinite(piv)) {
+					ok = 0;
+					break;
+				}
+
+				c->d[f+j] = piv;
+				lj[j] = 1;
+			}
+
+			double inv = 1.0/piv;
+			for (unsigned i=j+1; i<nr; i++) lj[i] *= inv;
+
+			for (unsigned k=j+1; k<w; k++) {
+				double* lk = l + (size_t)k*nr;
+				double coef = lj[k]*(c->kind == chol_ldlt ? piv : 1.0);
+				for (unsigned i=k; i<nr; i++) lk[i] -= coef*lj[i];
+			}
+		}
+
+		if (!ok) break;
+
+		//the rows below split into runs that fall into one target supernode's columns
+		for (unsigned i0=w; i0<nr;) {
+			unsigned t = c->snode[rows[i0]];
+			unsigned tf = c->super[t], tl = c->super[t+1];
+			unsigned i1 = i0;
+			while (i1 < nr && rows[i1] < tl) i1++;
+
+			//target structure contains ours from i0 down, merge for the relative positions
+			unsigned* trows = c->rows + c->row_ptr[t];
+			unsigned tnr = c->row_ptr[t+1] - c->row_ptr[t];
+			for (unsigned i=i0, p=0; i<nr; i++) {
+				while (trows[p] != rows[i]) p++;
+				rel[i] = p;
+			}
+
+			for (unsigned ic=i0; ic<i1; ic++) {
+				//tmp = l[ic.., :] d l[ic, :]^T, then subtracted from target column rows[ic]
+				//four panel columns per pass over tmp, which is what bounds this loop otherwise
+				for (unsigned i=ic; i<nr; i++) tmp[i] = 0;
+
+				unsigned k = 0;
+				for (; k+4<=w; k+=4) {
+					const double* l0 = l + (size_t)k*nr;
+					const double *l1 = l0 + nr, *l2 = l1 + nr, *l3 = l2 + nr;
+
+					double c0 = l0[ic], c1 = l1[ic], c2 = l2[ic], c3 = l3[ic];
+					if (c->kind == chol_ldlt) {
+						c0 *= c->d[f+k];
+						c1 *= c->d[f+k+1];
+						c2 *= c->d[f+k+2];
+						c3 *= c->d[f+k+3];
+					}
+
+					for (unsigned i=ic; i<nr; i++) tmp[i] += c0*l0[i] + c1*l1[i] + c2*l2[i] + c3*l3[i];
+				}
+
+				for (; k<w; k++) {
+					const double* lk = l + (size_t)k*nr;
+					double coef = lk[ic]*(c->kind == chol_ldlt ? c->d[f+k] : 1.0);
+					for (unsigned i=ic; i<nr; i++) tmp[i] += coef*lk[i];
+				}
+
+				double* tcol = c->val + c->val_ptr[t] + (size_t)(rows[ic] - tf)*tnr;
+				for (unsigned i=ic; i<nr; i++) tcol[rel[i]] -= tmp[i];
+			}
+
+			i0 = i1;
+		}
+	}
+
+	csr_free(&b);
+	drop(rel);
+	drop(tmp);
+	return ok;
+}
+
+//x = a^-1 b for nrhs right hand sides stored one after another, n entries each. b and x may alias
+//the sides are interleaved while solving, so every update streams the factor once for the whole batch
+void chol_solve(chol_t* c, const double* b, double* x, unsigned nrhs) {
+	unsigned n = c->n;
+	if (nrhs > c->work_rhs) {
+		drop(c->work);
+		c->work = heap(sizeof(double)*(n ? (size_t)n*nrhs : 1));
+		c->work_rhs = nrhs;
+	}
+
+	double* wk = c->work;
+	for (unsigned r=0; r<nrhs; r++) {
+		for (unsigned i=0; i<n; i++) wk[(size_t)i*nrhs + r] = b[(size_t)r*n + c->perm.perm[i]];
+	}
+
+	//l y = b
+	for (unsigned s=0; s<c->nsuper; s++) {
+		unsigned f = c->super[s], w = c->super[s+1] - f;
+		const unsigned* rows = c->rows + c->row_ptr[s];
+		unsigned nr = c->row_ptr[s+1] - c->row_ptr[s];
+		const double* l = c->val + c->val_ptr[s];
+
+		for (unsigned j=0; j<w; j++) {
+			const double* lj = l + (size_t)j*nr;
+			double* yj = wk + (size_t)(f+j)*nrhs;
+			if (c->kind == chol_llt) {
+				for (unsigned r=0; r<nrhs; r++) yj[r] /= lj[j];
+			}
+
+			for (unsigned i=j+1; i<nr; i++) {
+				double* yi = wk + (size_t)rows[i]*nrhs;
+				for (unsigned r=0; r<nrhs; r++) yi[r] -= lj[i]*yj[r];
+			}
+		}
+	}
+
+	if (c->kind == chol_ldlt) {
+		for (unsigned i=0; i<n; i++) {
+			double inv = 1.0/c->d[i];
+			for (unsigned r=0; r<nrhs; r++) wk[(size_t)i*nrhs + r] *= inv;
+		}
+	}
+
+	//l^T x = y
+	for (unsigned s=c->nsuper; s-- > 0;) {
+		unsigned f = c->super[s], w = c->super[s+1] - f;
+		const unsigned* rows = c->rows + c->row_ptr[s];
+		unsigned nr = c->row_ptr[s+1] - c->row_ptr[s];
+		const double* l = c->val + c->val_ptr[s];
+
+		for (unsigned j=w; j-- > 0;) {
+			const double* lj = l + (size_t)j*nr;
+			double* xj = wk + (size_t)(f+j)*nrhs;
+
+			for (unsigned i=j+1; i<nr; i++) {
+				const double* xi = wk + (size_t)rows[i]*nrhs;
+				for (unsigned r=0; r<nrhs; r++) xj[r] -= lj[i]*xi[r];
+			}
+
+			if (c->kind == chol_llt) {
+				for (unsigned r=0; r<nrhs; r++) xj[r] /= lj[j];
+			}
+		}
+	}
+
+	for (unsigned r=0; r<nrhs; r++) {
+		for (unsigned i=0; i<n; i++) x[(size_t)r*n + c->perm.perm[i]] = wk[(size_t)i*nrhs + r];
+	}
+}
+
+void chol_free(chol_t* c) {
+	reorder_free(&c->perm);
+	drop(c->parent);
+	drop(c->super);
+	drop(c->snode);
+	drop(c->row_ptr);
+	drop(c->rows);
+	drop(c->val_ptr);
+	drop(c->val);
+	drop(c->d);
+	drop(c->work);
+}
@@ -0,0 +1,33 @@
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_X86
+#endif
+
+//runtime instruction set checks for the kernels that carry target attributed simd paths, all 0 off x86
+
+int cpu_has_sse2() {
+#ifdef CPU_X86
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2");
+#else
+	return 0;
+#endif
+}
+
+//with fma, every avx2 kernel here is compiled for both
+int cpu_has_avx2() {
+#ifdef CPU_X86
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+	return 0;
+#endif
+}
+
+int cpu_has_avx512() {
+#ifdef CPU_X86
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx512f");
+#else
+	return 0;
+#endif
+}
@@ -1,63 +1,560 @@
-#include <field.h>
 #include <complex.h>
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
 
-//single axis fft
-complex float* fft_single(float* v, int v_stride, complex float* coeffs, int res, int stride) {
-	complex float* fftres = malloc(sizeof(complex float)*res);
+#include "util.h"
+#include "fft_simd.h"
+#include "pool.h"
 
-	if (res % 2 == 0) {
-		complex float* fft1 = fft_single(v, v_stride*2, coeffs, res/2, stride*2);
-		complex float* fft2 = fft_single(&v[v_stride], v_stride*2, coeffs, res/2, stride*2);
+typedef enum {
+	fft_forward = -1,
+	fft_inverse = 1
+} fft_dir;
 
-		//pls optimize idk assembeley
-		for (int i=0; i<res; i++) {
-			fftres[i] = fft1[i%(res/2)] + fft2[i%(res/2)]*coeffs[stride*(i%res)]; //rotation corresponding to the wave width
-		}
+typedef enum {
+	fft_f32,
+	fft_f64
+} fft_prec;
+
+typedef enum {
+	fft_pow2, //in place radix-2/4
+	fft_mixed, //stockham autosort over radices 4, 2, 3, 5, 7
+	fft_bluestein //chirp-z convolution through a power of two plan, for everything else
+} fft_kind;
+
+//reusable plan, everything a transform of size n needs is allocated up front
+//buffers are complex float or complex double according to prec
+typedef struct fft_plan {
+	fft_kind kind;
+	fft_prec prec;
+	unsigned n;
+	unsigned log2n;
+
+	unsigned* swaps; //bit reversal as (i, rev(i)) pairs with i < rev(i)
+	unsigned nswaps;
+
+	//pow2: per radix-4 stage of span m, w^k, w^2k, w^3k for k<m, each run of m contiguous
+	//mixed: per stage of radix p over length l, w^(k*t) for t=1..p-1, k<l/p
+	void* tw;
+	void* itw; //conjugates for the inverse direction
+
+	unsigned factors[32]; //a 32 bit length has at most 31 prime factors
+	unsigned nfactors;
+	complex double roots[2][7]; //e^(-+2 pi i t/7) for the generic radix
+	complex float rootsf[2][7]; //the same rounded once, so the float radix-7 loop converts nothing
+
+	void* scratch; //mixed: ping-pong buffer of n, bluestein: convolution buffer
+	unsigned scratch_len; //elements a caller supplied scratch needs, see fft_exec_scratch
+
+	struct fft_plan* conv; //bluestein: power of two plan of length >= 2n-1
+	void* chirp; //e^(-i pi k^2/n)
+	void* chirp_fft; //transform of the conjugate chirp, scaled by 1/conv->n
+} fft_plan_t;
+
+//e^(-2 pi i k/n) lives at w[k*stride], tables are shared between every length dividing theirs
+typedef struct {
+	const complex float* w;
+	const complex double* wd;
+	unsigned stride;
+} fft_twiddle_t;
+
+//many lines of one length split across a pool, every worker gets its own scratch
+typedef struct {
+	fft_plan_t* plan; //heap allocated so the batch can be moved around
+	pool_t* pool; //null runs serially
+
+	void* scratch; //plan->scratch_len per worker
+} fft_batch_t;
+
+//e^(-2 pi i k/n) in double, reduced to the first quadrant so the axes come out exact
+complex double fft_root(unsigned long long k, unsigned long long n) {
+	k %= n;
+	unsigned long long q = 4*k/n, r = 4*k%n;
+
+	double c, s;
+	if (2*r <= n) {
+		double t = M_PI_2*(double)r/(double)n;
+		c = cos(t);
+		s = sin(t);
 	} else {
-		memset(fftres, 0+0i, sizeof(complex float)*res);
+		double t = M_PI_2*(double)(n-r)/(double)n;
+		c = sin(t);
+		s = cos(t);
+	}
+
+	//e^(i theta) for theta = q*pi/2 + t, then conjugate
+	switch (q) {
+		case 0: return CMPLX(c, -s);
+		case 1: return CMPLX(-s, -c);
+		case 2: return CMPLX(-c, s);
+		default: return CMPLX(s, c);
+	}
+}
+
+static pthread_mutex_t fft_coeffs_lock = PTHREAD_MUTEX_INITIALIZER;
+static complex float** fft_coeffs_tables = NULL;
+static complex double** fft_coeffs_tablesd = NULL;
+static unsigned* fft_coeffs_sizes = NULL;
+static unsigned fft_coeffs_count = 0;
+
+//cached roots of unity for n, taken from the largest cached table whose length n divides
+//tables are read only once built and live until fft_coeffs_clear
+fft_twiddle_t fft_coeffs(unsigned n) {
+	pthread_mutex_lock(&fft_coeffs_lock);
+
+	unsigned best = fft_coeffs_count;
+	for (unsigned i=0; i<fft_coeffs_count; i++) {
+		if (fft_coeffs_sizes[i] % n == 0 && (best == fft_coeffs_count || fft_coeffs_sizes[i] > fft_coeffs_sizes[best])) best = i;
+	}
+
+	if (best == fft_coeffs_count) {
+		complex float* w = heap(sizeof(complex float)*n);
+		complex double* wd = heap(sizeof(complex double)*n);
+		for (unsigned k=0; k<n; k++) {
+			wd[k] = fft_root(k, n);
+			w[k] = CMPLXF((float)creal(wd[k]), (float)cimag(wd[k]));
+		}
+
+		fft_coeffs_tables = resize(fft_coeffs_tables, sizeof(complex float*)*(fft_coeffs_count+1));
+		fft_coeffs_tablesd = resize(fft_coeffs_tablesd, sizeof(complex double*)*(fft_coeffs_count+1));
+		fft_coeffs_sizes = resize(fft_coeffs_sizes, sizeof(unsigned)*(fft_coeffs_count+1));
+		fft_coeffs_tables[fft_coeffs_count] = w;
+		fft_coeffs_tablesd[fft_coeffs_count] = wd;
+		fft_coeffs_sizes[fft_coeffs_count] = n;
+		fft_coeffs_count++;
+	}
+
+	fft_twiddle_t twiddle = {.w=fft_coeffs_tables[best], .wd=fft_coeffs_tablesd[best], .stride=fft_coeffs_sizes[best]/n};
+	pthread_mutex_unlock(&fft_coeffs_lock);
+
+	return twiddle;
+}
+
+//only once nothing references the tables anymore, plans copy what they need at creation
+void fft_coeffs_clear() {
+	pthread_mutex_lock(&fft_coeffs_lock);
+
+	for (unsigned i=0; i<fft_coeffs_count; i++) {
+		drop(fft_coeffs_tables[i]);
+		drop(fft_coeffs_tablesd[i]);
+	}
+
+	drop(fft_coeffs_tables);
+	drop(fft_coeffs_tablesd);
+	drop(fft_coeffs_sizes);
+
+	fft_coeffs_tables = NULL;
+	fft_coeffs_tablesd = NULL;
+	fft_coeffs_sizes = NULL;
+	fft_coeffs_count = 0;
+
+	pthread_mutex_unlock(&fft_coeffs_lock);
+}
+
+//every kernel of one precision, instantiated for float and double below. T the real type, MK/RE/IM/CONJ its
+//complex helpers, W the fft_twiddle_t table, ROOTS the plan's radix-7 roots and RADIX4/KCMUL the fft_kernels_t entries
+#define FFT_DEFINE(sfx, T, MK, RE, IM, CONJ, W, ROOTS, RADIX4, KCMUL) \
+static void fft_radix2_##sfx(complex T* x, unsigned n) { \
+	for (unsigned i=0; i<n; i+=2) { \
+		complex T a = x[i], b = x[i+1]; \
+		x[i] = a + b; \
+		x[i+1] = a - b; \
+	} \
+} \
+\
+/* one stockham pass: radix p over length l with stride s, x -> y */ \
+static void fft_stockham_##sfx(fft_plan_t* plan, const complex T* x, complex T* y, unsigned p, unsigned l, unsigned s, const complex T* tw, fft_dir dir) { \
+	unsigned m = l/p; \
+	T rot = dir == fft_forward ? (T)-1 : (T)1; /* sign of i in the primitive root */ \
+\
+	for (unsigned k=0; k<m; k++) { \
+		const complex T* x0 = x + s*k; \
+		complex T* y0 = y + s*p*k; \
+\
+		switch (p) { \
+			case 2: { \
+				complex T w1 = tw[k]; \
+				for (unsigned q=0; q<s; q++) { \
+					complex T a0 = x0[q], a1 = x0[q + s*m]; \
+					y0[q] = a0 + a1; \
+					y0[q + s] = FFT_CMUL(MK, RE, IM, a0 - a1, w1); \
+				} \
+\
+				break; \
+			} \
+			case 3: { \
+				const T sin60 = (T)0.86602540378443864676; \
+				complex T w1 = tw[k], w2 = tw[m + k]; \
+				for (unsigned q=0; q<s; q++) { \
+					complex T a0 = x0[q], a1 = x0[q + s*m], a2 = x0[q + 2*s*m]; \
+					complex T t1 = a1 + a2, t2 = a0 - (T)0.5*t1, d = rot*sin60*(a1 - a2); \
+					complex T t3 = MK(-IM(d), RE(d)); \
+\
+					y0[q] = a0 + t1; \
+					y0[q + s] = FFT_CMUL(MK, RE, IM, t2 + t3, w1); \
+					y0[q + 2*s] = FFT_CMUL(MK, RE, IM, t2 - t3, w2); \
+				} \
+\
+				break; \
+			} \
+			case 4: { \
+				complex T w1 = tw[k], w2 = tw[m + k], w3 = tw[2*m + k]; \
+				for (unsigned q=0; q<s; q++) { \
+					complex T a0 = x0[q], a1 = x0[q + s*m], a2 = x0[q + 2*s*m], a3 = x0[q + 3*s*m]; \
+					complex T t0 = a0 + a2, t1 = a0 - a2, t2 = a1 + a3, d = rot*(a1 - a3); \
+					complex T t3 = MK(-IM(d), RE(d)); \
+\
+					y0[q] = t0 + t2; \
+					y0[q + s] = FFT_CMUL(MK, RE, IM, t1 + t3, w1); \
+					y0[q + 2*s] = FFT_CMUL(MK, RE, IM, t0 - t2, w2); \
+					y0[q + 3*s] = FFT_CMUL(MK, RE, IM, t1 - t3, w3); \
+				} \
+\
+				break; \
+			} \
+			case 5: { \
+				const T c1 = (T)0.30901699437494742410, c2 = -(T)0.80901699437494742410; \
+				const T s1 = (T)0.95105651629515357212, s2 = (T)0.58778525229247312917; \
+				complex T w1 = tw[k], w2 = tw[m + k], w3 = tw[2*m + k], w4 = tw[3*m + k]; \
+\
+				for (unsigned q=0; q<s; q++) { \
+					complex T a0 = x0[q], a1 = x0[q + s*m], a2 = x0[q + 2*s*m], a3 = x0[q + 3*s*m], a4 = x0[q + 4*s*m]; \
+					complex T b1 = a1 + a4, b2 = a2 + a3, d1 = a1 - a4, d2 = a2 - a3; \
+\
+					complex T r1 = a0 + c1*b1 + c2*b2, r2 = a0 + c2*b1 + c1*b2; \
+					complex T i1 = rot*(s1*d1 + s2*d2), i2 = rot*(s2*d1 - s1*d2); \
+					i1 = MK(-IM(i1), RE(i1)); \
+					i2 = MK(-IM(i2), RE(i2)); \
+\
+					y0[q] = a0 + b1 + b2; \
+					y0[q + s] = FFT_CMUL(MK, RE, IM, r1 + i1, w1); \
+					y0[q + 2*s] = FFT_CMUL(MK, RE, IM, r2 + i2, w2); \
+					y0[q + 3*s] = FFT_CMUL(MK, RE, IM, r2 - i2, w3); \
+					y0[q + 4*s] = FFT_CMUL(MK, RE, IM, r1 - i1, w4); \
+				} \
+\
+				break; \
+			} \
+			default: { \
+				/* only 7 lands here, plain O(p^2) dft over the precomputed roots */ \
+				const complex T* root = plan->ROOTS[dir == fft_forward ? 0 : 1]; \
+				for (unsigned q=0; q<s; q++) { \
+					for (unsigned t=0; t<p; t++) { \
+						complex T acc = 0; \
+						for (unsigned r=0; r<p; r++) acc += FFT_CMUL(MK, RE, IM, x0[q + r*s*m], root[(r*t) % p]); \
+						y0[q + t*s] = t == 0 ? acc : FFT_CMUL(MK, RE, IM, acc, tw[(t-1)*m + k]); \
+					} \
+				} \
+			} \
+		} \
+	} \
+} \
+\
+static void fft_exec_pow2_##sfx(fft_plan_t* plan, complex T* x, fft_dir dir) { \
+	unsigned n = plan->n; \
+\
+	for (unsigned i=0; i<plan->nswaps; i+=2) { \
+		complex T t = x[plan->swaps[i]]; \
+		x[plan->swaps[i]] = x[plan->swaps[i+1]]; \
+		x[plan->swaps[i+1]] = t; \
+	} \
+\
+	unsigned m = 1; \
+	if (plan->log2n % 2) { \
+		fft_radix2_##sfx(x, n); \
+		m = 2; \
+	} \
+\
+	const complex T* tw = dir == fft_forward ? plan->tw : plan->itw; \
+	for (; 4*m <= n; m *= 4) { \
+		fft_kernels()->RADIX4(x, n, m, tw, dir == fft_inverse); \
+		tw += 3*m; \
+	} \
+} \
+\
+static void fft_exec_mixed_##sfx(fft_plan_t* plan, complex T* x, fft_dir dir, complex T* scratch) { \
+	const complex T* tw = dir == fft_forward ? plan->tw : plan->itw; \
+	complex T* src = x; \
+	complex T* dst = scratch; \
+\
+	unsigned l = plan->n, s = 1; \
+	for (unsigned f=0; f<plan->nfactors; f++) { \
+		unsigned p = plan->factors[f]; \
+		fft_stockham_##sfx(plan, src, dst, p, l, s, tw, dir); \
+\
+		tw += (p-1)*(l/p); \
+		l /= p; \
+		s *= p; \
+\
+		complex T* t = src; \
+		src = dst; \
+		dst = t; \
+	} \
+\
+	if (src != x) memcpy(x, src, sizeof(complex T)*plan->n); \
+} \
+\
+/* inverse runs the forward convolution on conjugates */ \
+static void fft_exec_bluestein_##sfx(fft_plan_t* plan, complex T* x, fft_dir dir, complex T* scratch) { \
+	unsigned n = plan->n, m = plan->conv->n; \
+	const complex T* chirp = plan->chirp; \
+	complex T* w = scratch; \
+\
+	for (unsigned k=0; k<n; k++) { \
+		w[k] = FFT_CMUL(MK, RE, IM, dir == fft_forward ? x[k] : CONJ(x[k]), chirp[k]); \
+	} \
+\
+	memset(w + n, 0, sizeof(complex T)*(m-n)); \
+\
+	fft_exec_pow2_##sfx(plan->conv, w, fft_forward); \
+	fft_kernels()->KCMUL(w, plan->chirp_fft, m); \
+	fft_exec_pow2_##sfx(plan->conv, w, fft_inverse); \
+\
+	for (unsigned k=0; k<n; k++) { \
+		complex T v = FFT_CMUL(MK, RE, IM, w[k], chirp[k]); \
+		x[k] = dir == fft_forward ? v : CONJ(v); \
+	} \
+} \
+\
+static void fft_exec_##sfx(fft_plan_t* plan, complex T* x, fft_dir dir, complex T* scratch) { \
+	switch (plan->kind) { \
+		case fft_pow2: fft_exec_pow2_##sfx(plan, x, dir); break; \
+		case fft_mixed: fft_exec_mixed_##sfx(plan, x, dir, scratch); break; \
+		case fft_bluestein: fft_exec_bluestein_##sfx(plan, x, dir, scratch); break; \
+	} \
+} \
+\
+/* radix-4 spans start at 2 when an odd radix-2 stage goes first, 3m per stage sums to < n */ \
+static void fft_twiddle_pow2_##sfx(fft_plan_t* plan) { \
+	unsigned n = plan->n; \
+	complex T* tw = plan->tw = heap(sizeof(complex T)*(n+1)); \
+	complex T* itw = plan->itw = heap(sizeof(complex T)*(n+1)); \
+	fft_twiddle_t roots = fft_coeffs(n); \
+\
+	for (unsigned m = plan->log2n % 2 ? 2 : 1; 4*m <= n; m *= 4) { \
+		for (unsigned k=0; k<m; k++) { \
+			for (unsigned p=1; p<=3; p++) { \
+				tw[(p-1)*m + k] = roots.W[(size_t)p*k*(n/(4*m))*roots.stride]; \
+				itw[(p-1)*m + k] = CONJ(tw[(p-1)*m + k]); \
+			} \
+		} \
+\
+		tw += 3*m; \
+		itw += 3*m; \
+	} \
+} \
+\
+/* (p-1)/p of each remaining length, the lengths shrink by at least half every stage */ \
+static void fft_twiddle_mixed_##sfx(fft_plan_t* plan) { \
+	unsigned n = plan->n; \
+	complex T* tw = plan->tw = heap(sizeof(complex T)*2*n); \
+	complex T* itw = plan->itw = heap(sizeof(complex T)*2*n); \
+	fft_twiddle_t roots = fft_coeffs(n); \
+\
+	unsigned l = n; \
+	for (unsigned f=0; f<plan->nfactors; f++) { \
+		unsigned p = plan->factors[f], m = l/p; \
+\
+		for (unsigned t=1; t<p; t++) { \
+			for (unsigned k=0; k<m; k++) { \
+				tw[(t-1)*m + k] = roots.W[(size_t)k*t*(n/l)*roots.stride]; \
+				itw[(t-1)*m + k] = CONJ(tw[(t-1)*m + k]); \
+			} \
+		} \
+\
+		tw += (p-1)*m; \
+		itw += (p-1)*m; \
+		l = m; \
+	} \
+} \
+\
+/* conv is already planned at the same precision */ \
+static void fft_chirp_##sfx(fft_plan_t* plan) { \
+	unsigned n = plan->n, m = plan->conv->n; \
+	complex T* chirp = plan->chirp = heap(sizeof(complex T)*n); \
+	complex T* chirp_fft = plan->chirp_fft = heap(sizeof(complex T)*m); \
+	fft_twiddle_t roots = fft_coeffs(2*n); \
+\
+	for (unsigned k=0; k<n; k++) { \
+		/* e^(-i pi k^2/n) = w_2n^(k^2 mod 2n), exact for large k */ \
+		chirp[k] = roots.W[((unsigned long long)k*k % (2ull*n))*roots.stride]; \
+	} \
+\
+	memset(chirp_fft, 0, sizeof(complex T)*m); \
+	chirp_fft[0] = CONJ(chirp[0]); \
+	for (unsigned k=1; k<n; k++) { \
+		chirp_fft[k] = chirp_fft[m-k] = CONJ(chirp[k]); \
+	} \
+\
+	fft_exec_pow2_##sfx(plan->conv, chirp_fft, fft_forward); \
+	for (unsigned k=0; k<m; k++) chirp_fft[k] /= (T)m; \
+}
+
+FFT_DEFINE(f, float, CMPLXF, crealf, cimagf, conjf, w, rootsf, radix4, cmul);
+FFT_DEFINE(d, double, CMPLX, creal, cimag, conj, wd, roots, radix4d, cmuld);
+
+unsigned fft_prec_size(fft_prec prec) {
+	return prec == fft_f64 ? sizeof(complex double) : sizeof(complex float);
+}
 
-		for (unsigned i=0; i<res; i++) {
-			for (unsigned vi=0; vi<res; vi++) {
-				fftres[i] += (v[vi*v_stride] * (1+i)) * coeffs[stride*((i*vi) % res)];
-			}
+//same as fft_exec with the caller's scratch (plan->scratch_len elements), so threads can share a plan
+void fft_exec_scratch(fft_plan_t* plan, void* x, fft_dir dir, void* scratch) {
+	if (plan->n < 2) return;
+
+	if (plan->prec == fft_f64) fft_exec_d(plan, x, dir, scratch);
+	else fft_exec_f(plan, x, dir, scratch);
+}
+
+//in place on complex float or double per the plan, no allocations. the inverse is unnormalized (scale by 1/n yourself)
+void fft_exec(fft_plan_t* plan, void* x, fft_dir dir) {
+	fft_exec_scratch(plan, x, dir, plan->scratch);
+}
+
+static fft_plan_t fft_plan_pow2(unsigned n, fft_prec prec) {
+	fft_plan_t plan = {.kind=fft_pow2, .prec=prec, .n=n};
+	while ((1u<<plan.log2n) < n) plan.log2n++;
+
+	plan.swaps = heap(sizeof(unsigned)*n);
+	for (unsigned i=0; i<n; i++) {
+		unsigned r = 0;
+		for (unsigned b=0; b<plan.log2n; b++) {
+			if (i & (1u<<b)) r |= 1u<<(plan.log2n-1-b);
+		}
+
+		if (i < r) {
+			plan.swaps[plan.nswaps++] = i;
+			plan.swaps[plan.nswaps++] = r;
 		}
 	}
 
-	return fftres;
+	if (prec == fft_f64) fft_twiddle_pow2_d(&plan);
+	else fft_twiddle_pow2_f(&plan);
+
+	return plan;
+}
+
+static fft_plan_t fft_plan_mixed(unsigned n, fft_prec prec, unsigned* factors, unsigned nfactors) {
+	fft_plan_t plan = {.kind=fft_mixed, .prec=prec, .n=n, .nfactors=nfactors};
+	memcpy(plan.factors, factors, sizeof(unsigned)*nfactors);
+
+	for (unsigned t=0; t<7; t++) {
+		plan.roots[0][t] = fft_root(t, 7);
+		plan.roots[1][t] = conj(plan.roots[0][t]);
+		for (unsigned d=0; d<2; d++) plan.rootsf[d][t] = CMPLXF((float)creal(plan.roots[d][t]), (float)cimag(plan.roots[d][t]));
+	}
+
+	plan.scratch_len = n;
+	plan.scratch = heap(fft_prec_size(prec)*n);
+
+	if (prec == fft_f64) fft_twiddle_mixed_d(&plan);
+	else fft_twiddle_mixed_f(&plan);
+
+	return plan;
+}
+
+static fft_plan_t fft_plan_bluestein(unsigned n, fft_prec prec) {
+	fft_plan_t plan = {.kind=fft_bluestein, .prec=prec, .n=n};
+
+	unsigned m = 1;
+	while (m < 2*n-1) m *= 2;
+
+	plan.conv = heap(sizeof(fft_plan_t));
+	*plan.conv = fft_plan_pow2(m, prec);
+
+	plan.scratch_len = m;
+	plan.scratch = heap(fft_prec_size(prec)*m);
+
+	if (prec == fft_f64) fft_chirp_d(&plan);
+	else fft_chirp_f(&plan);
+
+	return plan;
 }
 
-// "full" spectral method, fft_single can also approximate by using rows and then solved with a tridiagonal matrix
-// see http://farside.ph.utexas.edu/teaching/329/lectures/node67.html
-float* fftsimple(axis_t* base, unsigned char part, complex float* coeffs, int stride) {
-	//not fast, easier to multiply than iterate axis
-	//complexity only goes up by a degree of 3 :)
-	//i feel like ive lost the ability to think
+//picks the factorization: powers of two in place, 7-smooth sizes mixed radix, bluestein otherwise
+fft_plan_t fft_plan_prec(unsigned n, fft_prec prec) {
+	fft_kernels(); //settle the simd level before plans are shared between threads
+	if (n == 0) return (fft_plan_t){.prec=prec};
+	if ((n & (n-1)) == 0) return fft_plan_pow2(n, prec);
 
-	int d = axis_length(base);
-	float* fftres = malloc(sizeof(complex float)*d*d*d);
+	unsigned factors[32];
+	unsigned nfactors = 0;
 
-	axis_iter_t iter = axis_iter(base);
+	unsigned rest = n;
+	while (rest % 4 == 0) {
+		factors[nfactors++] = 4;
+		rest /= 4;
+	}
 
-	while (axis_next(&iter)) {
-		for (int x=0; x<d; x++) {
-			for (int y=0; x<d; x++) {
-				for (int z=0; x<d; x++) {
-					fftres[x*d*d + y*d + z] += iter.x[part]*(float)coeffs[x*iter.indices[0]+y*iter.indices[1]+z*iter.indices[2]];
-				}
-			}
+	static const unsigned radices[] = {2, 3, 5, 7};
+	for (unsigned r=0; r<4; r++) {
+		while (rest % radices[r] == 0) {
+			factors[nfactors++] = radices[r];
+			rest /= radices[r];
 		}
 	}
 
-	return fftres;
+	if (rest == 1) return fft_plan_mixed(n, prec, factors, nfactors);
+	else return fft_plan_bluestein(n, prec);
+}
+
+//single precision plan
+fft_plan_t fft_plan(unsigned n) {
+	return fft_plan_prec(n, fft_f32);
+}
+
+void fft_plan_free(fft_plan_t* plan) {
+	drop(plan->swaps);
+	drop(plan->tw);
+	drop(plan->itw);
+	drop(plan->scratch);
+
+	if (plan->conv) {
+		fft_plan_free(plan->conv);
+		drop(plan->conv);
+	}
+
+	drop(plan->chirp);
+	drop(plan->chirp_fft);
+}
+
+fft_batch_t fft_batch(unsigned n, fft_prec prec, pool_t* pool) {
+	fft_batch_t batch = {.pool=pool};
+	batch.plan = heap(sizeof(fft_plan_t));
+	*batch.plan = fft_plan_prec(n, prec);
+
+	fft_plan_t* plan = batch.plan;
+	if (plan->scratch_len) batch.scratch = heap(fft_prec_size(prec)*plan->scratch_len*pool_threads(pool));
+
+	return batch;
 }
 
-//utility to sample sine waves, then downscaled in recursive fft functions to reduce divisions
-complex float* fft_coeffs(unsigned N) {
-	complex float* coeffs = malloc(N*sizeof(complex float));
-	float fn = (float)N;
-	for (unsigned i=0; i<N; i++) {
-		coeffs[i] = sinf((float)i/fn);
+typedef struct {
+	fft_batch_t* batch;
+	char* x;
+	unsigned dist;
+	fft_dir dir;
+} fft_batch_job_t;
+
+static void fft_batch_lines(void* arg, unsigned worker, unsigned begin, unsigned end) {
+	fft_batch_job_t* job = arg;
+	fft_plan_t* plan = job->batch->plan;
+	size_t esz = fft_prec_size(plan->prec);
+	char* scratch = job->batch->scratch ? (char*)job->batch->scratch + (size_t)worker*plan->scratch_len*esz : NULL;
+
+	for (unsigned l=begin; l<end; l++) {
+		fft_exec_scratch(plan, job->x + (size_t)l*job->dist*esz, job->dir, scratch);
 	}
+}
+
+//transforms lines starting every dist elements, returns once all of them are done
+void fft_batch_exec(fft_batch_t* batch, void* x, unsigned lines, unsigned dist, fft_dir dir) {
+	fft_batch_job_t job = {.batch=batch, .x=x, .dist=dist, .dir=dir};
+	pool_run(batch->pool, fft_batch_lines, &job, lines, pool_grain(batch->pool, lines));
+}
 
-	return coeffs;
+void fft_batch_free(fft_batch_t* batch) {
+	fft_plan_free(batch->plan);
+	drop(batch->plan);
+	drop(batch->scratch);
 }
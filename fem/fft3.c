@@ -0,0 +1,117 @@
+#include <field.h>
+#include <complex.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "util.h"
+#include "fft.h"
+#include "pool.h"
+
+//tile edge for transposes, 16x16 complex doubles is 4kb per side and fits l1 with room to spare
+#define FFT3_BLOCK 16
+
+//separable transform over a nx*ny*nz grid stored x fastest: x[(z*ny + y)*nx + x]
+//grids are complex float or complex double according to prec
+typedef struct {
+	unsigned nx, ny, nz;
+	fft_prec prec;
+	fft_batch_t bx, by, bz;
+	pool_t* pool;
+
+	void* scratch; //one grid, transposes ping-pong through it
+} fft3_plan_t;
+
+//pool may be null to stay on the calling thread
+fft3_plan_t fft3_plan(unsigned nx, unsigned ny, unsigned nz, fft_prec prec, pool_t* pool) {
+	fft3_plan_t plan = {.nx=nx, .ny=ny, .nz=nz, .prec=prec, .pool=pool};
+	plan.bx = fft_batch(nx, prec, pool);
+	plan.by = fft_batch(ny, prec, pool);
+	plan.bz = fft_batch(nz, prec, pool);
+	plan.scratch = heap((size_t)fft_prec_size(prec)*nx*ny*nz);
+
+	return plan;
+}
+
+typedef struct {
+	const void* a;
+	void* b;
+	unsigned rows, cols;
+	fft_prec prec;
+} fft3_transpose_t;
+
+//b = a^T for a rows*cols matrix, tiled so both sides stream through cache lines. work items are row tiles
+static void fft3_transpose_tiles(void* arg, unsigned worker, unsigned begin, unsigned end) {
+	fft3_transpose_t* t = arg;
+	unsigned rows = t->rows, cols = t->cols;
+
+	for (unsigned i0=begin*FFT3_BLOCK; i0<rows && i0<end*FFT3_BLOCK; i0+=FFT3_BLOCK) {
+		unsigned i1 = i0+FFT3_BLOCK < rows ? i0+FFT3_BLOCK : rows;
+
+		for (unsigned j0=0; j0<cols; j0+=FFT3_BLOCK) {
+			unsigned j1 = j0+FFT3_BLOCK < cols ? j0+FFT3_BLOCK : cols;
+
+			//moved as plain words, a complex float is one 64 bit copy
+			if (t->prec == fft_f64) {
+				const complex double* a = t->a;
+				complex double* b = t->b;
+				for (unsigned i=i0; i<i1; i++) {
+					for (unsigned j=j0; j<j1; j++) b[(size_t)j*rows + i] = a[(size_t)i*cols + j];
+				}
+			} else {
+				const uint64_t* a = t->a;
+				uint64_t* b = t->b;
+				for (unsigned i=i0; i<i1; i++) {
+					for (unsigned j=j0; j<j1; j++) b[(size_t)j*rows + i] = a[(size_t)i*cols + j];
+				}
+			}
+		}
+	}
+}
+
+static void fft3_transpose(pool_t* pool, fft_prec prec, const void* a, void* b, unsigned rows, unsigned cols) {
+	fft3_transpose_t t = {.a=a, .b=b, .rows=rows, .cols=cols, .prec=prec};
+	unsigned tiles = (rows + FFT3_BLOCK - 1)/FFT3_BLOCK;
+	pool_run(pool, fft3_transpose_tiles, &t, tiles, pool_grain(pool, tiles));
+}
+
+//each transpose rotates the axes (zyx -> xzy -> yxz -> zyx), so every pass runs on contiguous lines
+void fft3_exec(fft3_plan_t* plan, void* x, fft_dir dir) {
+	unsigned nx = plan->nx, ny = plan->ny, nz = plan->nz;
+	void* s = plan->scratch;
+
+	fft_batch_exec(&plan->bx, x, ny*nz, nx, dir);
+	fft3_transpose(plan->pool, plan->prec, x, s, nz*ny, nx);
+
+	fft_batch_exec(&plan->by, s, nx*nz, ny, dir);
+	fft3_transpose(plan->pool, plan->prec, s, x, nx*nz, ny);
+
+	fft_batch_exec(&plan->bz, x, ny*nx, nz, dir);
+	fft3_transpose(plan->pool, plan->prec, x, s, ny*nx, nz);
+
+	memcpy(x, s, (size_t)fft_prec_size(plan->prec)*nx*ny*nz);
+}
+
+void fft3_plan_free(fft3_plan_t* plan) {
+	fft_batch_free(&plan->bx);
+	fft_batch_free(&plan->by);
+	fft_batch_free(&plan->bz);
+	drop(plan->scratch);
+}
+
+// "full" spectral method over one component of a field, plan has to be d*d*d for an axis of length d
+// spectral_lines_t solves rows with a tridiagonal matrix instead of the last transform
+// see http://farside.ph.utexas.edu/teaching/329/lectures/node67.html
+//out is complex float or complex double following the plan
+void fft_field(axis_t* base, unsigned char part, fft3_plan_t* plan, void* out, fft_dir dir) {
+	unsigned d = axis_length(base);
+	memset(out, 0, (size_t)fft_prec_size(plan->prec)*d*d*d);
+
+	axis_iter_t iter = axis_iter(base);
+	while (axis_next(&iter)) {
+		size_t i = ((size_t)iter.indices[2]*d + iter.indices[1])*d + iter.indices[0];
+		if (plan->prec == fft_f64) ((complex double*)out)[i] = iter.x[part];
+		else ((complex float*)out)[i] = iter.x[part];
+	}
+
+	fft3_exec(plan, out, dir);
+}
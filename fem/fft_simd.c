@@ -0,0 +1,313 @@
+#include <complex.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FFT_SIMD_X86
+#include <immintrin.h>
+#endif
+
+#include "cpu.h"
+
+//complex multiply without the nan/inf recovery path the compiler emits for operator *, for every scalar path of
+//the fft, rfft and fft_simd. a macro so it inlines across files, the arguments are evaluated more than once
+#define FFT_CMUL(mk, re, im, a, b) mk(re(a)*re(b) - im(a)*im(b), re(a)*im(b) + im(a)*re(b))
+#define FFT_CMULF(a, b) FFT_CMUL(CMPLXF, crealf, cimagf, a, b)
+#define FFT_CMULD(a, b) FFT_CMUL(CMPLX, creal, cimag, a, b)
+
+typedef enum {
+	fft_simd_scalar,
+	fft_simd_sse2,
+	fft_simd_avx2, //with fma
+	fft_simd_avx512
+} fft_simd;
+
+//radix-4 stage over interleaved complex floats, same contract as the scalar reference below
+typedef void (*fft_radix4_fn)(complex float* x, unsigned n, unsigned m, const complex float* tw, int inv);
+//x[i] *= w[i]
+typedef void (*fft_cmul_fn)(complex float* x, const complex float* w, unsigned n);
+//same over complex doubles
+typedef void (*fft_radix4d_fn)(complex double* x, unsigned n, unsigned m, const complex double* tw, int inv);
+typedef void (*fft_cmuld_fn)(complex double* x, const complex double* w, unsigned n);
+
+typedef struct {
+	fft_simd level;
+	fft_radix4_fn radix4;
+	fft_cmul_fn cmul;
+	fft_radix4d_fn radix4d;
+	fft_cmuld_fn cmuld;
+} fft_kernels_t;
+
+//reference kernels for float (sfx empty) and double (sfx d), everything else has to match them within rounding
+//combines four interleaved sub-transforms of length m (in bit reversed order: q0, q2, q1, q3)
+#define FFT_SIMD_SCALAR(sfx, T, MK, RE, IM) \
+static void fft_radix4##sfx##_scalar(complex T* x, unsigned n, unsigned m, const complex T* tw, int inv) { \
+	const complex T* tw1 = tw; \
+	const complex T* tw2 = tw + m; \
+	const complex T* tw3 = tw + 2*m; \
+	const T sg = inv ? (T)-1 : (T)1; \
+\
+	for (unsigned blk=0; blk<n; blk+=4*m) { \
+		complex T* y = x + blk; \
+\
+		for (unsigned k=0; k<m; k++) { \
+			complex T a = y[k]; \
+			complex T b = FFT_CMUL(MK, RE, IM, y[k+m], tw2[k]); \
+			complex T c = FFT_CMUL(MK, RE, IM, y[k+2*m], tw1[k]); \
+			complex T d = FFT_CMUL(MK, RE, IM, y[k+3*m], tw3[k]); \
+\
+			complex T s0 = a+b, s1 = a-b; \
+			complex T s2 = c+d, s3 = c-d; \
+\
+			/* multiply by -i going forward, +i going back */ \
+			s3 = MK(sg*IM(s3), -sg*RE(s3)); \
+\
+			y[k] = s0 + s2; \
+			y[k+m] = s1 + s3; \
+			y[k+2*m] = s0 - s2; \
+			y[k+3*m] = s1 - s3; \
+		} \
+	} \
+} \
+\
+static void fft_cmul##sfx##_scalar(complex T* x, const complex T* w, unsigned n) { \
+	for (unsigned i=0; i<n; i++) x[i] = FFT_CMUL(MK, RE, IM, x[i], w[i]); \
+}
+
+FFT_SIMD_SCALAR(, float, CMPLXF, crealf, cimagf);
+FFT_SIMD_SCALAR(d, double, CMPLX, creal, cimag);
+
+#ifdef FFT_SIMD_X86
+
+//per isa and precision only the complex multiply, the sign mask for the +-i rotation and the rotation itself
+//differ, the loops around them come from the macros further down
+
+//sse2 has no addsub, so the sign flip for the real lanes is an xor
+__attribute__((target("sse2")))
+static inline __m128 fft_sse2_cmul(__m128 a, __m128 b) {
+	const __m128 neg_re = _mm_castsi128_ps(_mm_set_epi32(0, (int)0x80000000, 0, (int)0x80000000));
+	__m128 br = _mm_shuffle_ps(b, b, _MM_SHUFFLE(2, 2, 0, 0));
+	__m128 bi = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 3, 1, 1));
+	__m128 as = _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1));
+	return _mm_add_ps(_mm_mul_ps(a, br), _mm_xor_ps(_mm_mul_ps(as, bi), neg_re));
+}
+
+//(re, im) -> (im, re) then negate one lane: -i forward, +i inverse
+__attribute__((target("sse2")))
+static inline __m128 fft_sse2_sign(int inv) {
+	return inv ? _mm_castsi128_ps(_mm_set_epi32(0, (int)0x80000000, 0, (int)0x80000000))
+		: _mm_castsi128_ps(_mm_set_epi32((int)0x80000000, 0, (int)0x80000000, 0));
+}
+
+__attribute__((target("sse2")))
+static inline __m128 fft_sse2_rot(__m128 v, __m128 sign) {
+	return _mm_xor_ps(_mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)), sign);
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256 fft_avx2_cmul(__m256 a, __m256 b) {
+	__m256 as = _mm256_permute_ps(a, 0xB1);
+	return _mm256_fmaddsub_ps(a, _mm256_moveldup_ps(b), _mm256_mul_ps(as, _mm256_movehdup_ps(b)));
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256 fft_avx2_sign(int inv) {
+	return _mm256_castsi256_ps(inv ? _mm256_set1_epi64x(0x0000000080000000ll) : _mm256_set1_epi64x((long long)0x8000000000000000ull));
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256 fft_avx2_rot(__m256 v, __m256 sign) {
+	return _mm256_xor_ps(_mm256_permute_ps(v, 0xB1), sign);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512 fft_avx512_cmul(__m512 a, __m512 b) {
+	__m512 as = _mm512_permute_ps(a, 0xB1);
+	return _mm512_fmaddsub_ps(a, _mm512_moveldup_ps(b), _mm512_mul_ps(as, _mm512_movehdup_ps(b)));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512 fft_avx512_sign(int inv) {
+	return _mm512_castsi512_ps(inv ? _mm512_set1_epi64(0x0000000080000000ll) : _mm512_set1_epi64((long long)0x8000000000000000ull));
+}
+
+//avx512f has no float xor, flip signs in the integer domain
+__attribute__((target("avx512f")))
+static inline __m512 fft_avx512_rot(__m512 v, __m512 sign) {
+	return _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(_mm512_permute_ps(v, 0xB1)), _mm512_castps_si512(sign)));
+}
+
+//double kernels hold one complex per 128 bits, so the widths halve and the sign masks are 64 bit
+__attribute__((target("sse2")))
+static inline __m128d fft_sse2_cmuld(__m128d a, __m128d b) {
+	const __m128d neg_re = _mm_castsi128_pd(_mm_set_epi64x(0, (long long)0x8000000000000000ull));
+	__m128d br = _mm_unpacklo_pd(b, b);
+	__m128d bi = _mm_unpackhi_pd(b, b);
+	__m128d as = _mm_shuffle_pd(a, a, 1);
+	return _mm_add_pd(_mm_mul_pd(a, br), _mm_xor_pd(_mm_mul_pd(as, bi), neg_re));
+}
+
+__attribute__((target("sse2")))
+static inline __m128d fft_sse2_signd(int inv) {
+	return _mm_castsi128_pd(inv ? _mm_set_epi64x(0, (long long)0x8000000000000000ull)
+		: _mm_set_epi64x((long long)0x8000000000000000ull, 0));
+}
+
+__attribute__((target("sse2")))
+static inline __m128d fft_sse2_rotd(__m128d v, __m128d sign) {
+	return _mm_xor_pd(_mm_shuffle_pd(v, v, 1), sign);
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256d fft_avx2_cmuld(__m256d a, __m256d b) {
+	__m256d as = _mm256_permute_pd(a, 0x5);
+	return _mm256_fmaddsub_pd(a, _mm256_movedup_pd(b), _mm256_mul_pd(as, _mm256_permute_pd(b, 0xF)));
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256d fft_avx2_signd(int inv) {
+	return _mm256_castsi256_pd(inv ? _mm256_set_epi64x(0, (long long)0x8000000000000000ull, 0, (long long)0x8000000000000000ull)
+		: _mm256_set_epi64x((long long)0x8000000000000000ull, 0, (long long)0x8000000000000000ull, 0));
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256d fft_avx2_rotd(__m256d v, __m256d sign) {
+	return _mm256_xor_pd(_mm256_permute_pd(v, 0x5), sign);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512d fft_avx512_cmuld(__m512d a, __m512d b) {
+	__m512d as = _mm512_permute_pd(a, 0x55);
+	return _mm512_fmaddsub_pd(a, _mm512_movedup_pd(b), _mm512_mul_pd(as, _mm512_permute_pd(b, 0xFF)));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512d fft_avx512_signd(int inv) {
+	return _mm512_castsi512_pd(inv ? _mm512_set_epi64(0, (long long)0x8000000000000000ull, 0, (long long)0x8000000000000000ull,
+			0, (long long)0x8000000000000000ull, 0, (long long)0x8000000000000000ull)
+		: _mm512_set_epi64((long long)0x8000000000000000ull, 0, (long long)0x8000000000000000ull, 0,
+			(long long)0x8000000000000000ull, 0, (long long)0x8000000000000000ull, 0));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512d fft_avx512_rotd(__m512d v, __m512d sign) {
+	return _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(_mm512_permute_pd(v, 0x55)), _mm512_castpd_si512(sign)));
+}
+
+//radix-4 stage and pointwise multiply for one isa and precision. V is the register, W the intrinsic width prefix
+//(empty, 256, 512) and S the suffix (ps, pd). spans narrower than a register go to FALLBACK, the next isa down
+#define FFT_SIMD_KERNELS(isa, sfx, tgt, T, V, W, S, FALLBACK) \
+static __attribute__((target(tgt))) \
+void fft_radix4##sfx##_##isa(complex T* x, unsigned n, unsigned m, const complex T* tw, int inv) { \
+	const unsigned lanes = sizeof(V)/sizeof(T), per = sizeof(V)/sizeof(complex T); \
+	if (m < per) { \
+		FALLBACK(x, n, m, tw, inv); \
+		return; \
+	} \
+\
+	const V sign = fft_##isa##_sign##sfx(inv); \
+	const T* tw1 = (const T*)tw; \
+	const T* tw2 = (const T*)(tw + m); \
+	const T* tw3 = (const T*)(tw + 2*m); \
+\
+	for (unsigned blk=0; blk<n; blk+=4*m) { \
+		T* y0 = (T*)(x + blk); \
+		T* y1 = y0 + 2*m; \
+		T* y2 = y1 + 2*m; \
+		T* y3 = y2 + 2*m; \
+\
+		for (unsigned k=0; k<2*m; k+=lanes) { \
+			V a = _mm##W##_loadu_##S(y0+k); \
+			V b = fft_##isa##_cmul##sfx(_mm##W##_loadu_##S(y1+k), _mm##W##_loadu_##S(tw2+k)); \
+			V c = fft_##isa##_cmul##sfx(_mm##W##_loadu_##S(y2+k), _mm##W##_loadu_##S(tw1+k)); \
+			V d = fft_##isa##_cmul##sfx(_mm##W##_loadu_##S(y3+k), _mm##W##_loadu_##S(tw3+k)); \
+\
+			V s0 = _mm##W##_add_##S(a, b), s1 = _mm##W##_sub_##S(a, b); \
+			V s2 = _mm##W##_add_##S(c, d), s3 = fft_##isa##_rot##sfx(_mm##W##_sub_##S(c, d), sign); \
+\
+			_mm##W##_storeu_##S(y0+k, _mm##W##_add_##S(s0, s2)); \
+			_mm##W##_storeu_##S(y1+k, _mm##W##_add_##S(s1, s3)); \
+			_mm##W##_storeu_##S(y2+k, _mm##W##_sub_##S(s0, s2)); \
+			_mm##W##_storeu_##S(y3+k, _mm##W##_sub_##S(s1, s3)); \
+		} \
+	} \
+} \
+\
+static __attribute__((target(tgt))) \
+void fft_cmul##sfx##_##isa(complex T* x, const complex T* w, unsigned n) { \
+	const unsigned per = sizeof(V)/sizeof(complex T); \
+	unsigned i = 0; \
+	for (; i+per<=n; i+=per) { \
+		_mm##W##_storeu_##S((T*)(x+i), fft_##isa##_cmul##sfx(_mm##W##_loadu_##S((T*)(x+i)), _mm##W##_loadu_##S((const T*)(w+i)))); \
+	} \
+\
+	fft_cmul##sfx##_scalar(x+i, w+i, n-i); \
+}
+
+FFT_SIMD_KERNELS(sse2, , "sse2", float, __m128, , ps, fft_radix4_scalar);
+FFT_SIMD_KERNELS(avx2, , "avx2,fma", float, __m256, 256, ps, fft_radix4_sse2);
+FFT_SIMD_KERNELS(avx512, , "avx512f,avx2,fma", float, __m512, 512, ps, fft_radix4_avx2);
+FFT_SIMD_KERNELS(sse2, d, "sse2", double, __m128d, , pd, fft_radix4d_scalar);
+FFT_SIMD_KERNELS(avx2, d, "avx2,fma", double, __m256d, 256, pd, fft_radix4d_sse2);
+FFT_SIMD_KERNELS(avx512, d, "avx512f,avx2,fma", double, __m512d, 512, pd, fft_radix4d_avx2);
+
+#endif
+
+//best level the cpu (and os, for the wide registers) supports
+fft_simd fft_simd_detect() {
+#ifdef FFT_SIMD_X86
+	if (cpu_has_avx512()) return fft_simd_avx512;
+	if (cpu_has_avx2()) return fft_simd_avx2;
+	if (cpu_has_sse2()) return fft_simd_sse2;
+#endif
+	return fft_simd_scalar;
+}
+
+static fft_kernels_t fft_kernels_selected;
+static pthread_once_t fft_kernels_once = PTHREAD_ONCE_INIT;
+
+static fft_kernels_t fft_kernels_for(fft_simd level) {
+	fft_simd best = fft_simd_detect();
+	if (level > best) level = best;
+
+	fft_kernels_t kern = {fft_simd_scalar, fft_radix4_scalar, fft_cmul_scalar, fft_radix4d_scalar, fft_cmuld_scalar};
+
+#ifdef FFT_SIMD_X86
+	switch (level) {
+		case fft_simd_avx512: kern = (fft_kernels_t){level, fft_radix4_avx512, fft_cmul_avx512, fft_radix4d_avx512, fft_cmuld_avx512}; break;
+		case fft_simd_avx2: kern = (fft_kernels_t){level, fft_radix4_avx2, fft_cmul_avx2, fft_radix4d_avx2, fft_cmuld_avx2}; break;
+		case fft_simd_sse2: kern = (fft_kernels_t){level, fft_radix4_sse2, fft_cmul_sse2, fft_radix4d_sse2, fft_cmuld_sse2}; break;
+		default:;
+	}
+#endif
+
+	return kern;
+}
+
+//FEM_FFT_SIMD=scalar|sse2|avx2|avx512 caps the level picked on first use
+static void fft_kernels_default() {
+	fft_simd level = fft_simd_avx512;
+	const char* env = getenv("FEM_FFT_SIMD");
+
+	if (env) {
+		if (strcmp(env, "scalar") == 0) level = fft_simd_scalar;
+		else if (strcmp(env, "sse2") == 0) level = fft_simd_sse2;
+		else if (strcmp(env, "avx2") == 0) level = fft_simd_avx2;
+	}
+
+	fft_kernels_selected = fft_kernels_for(level);
+}
+
+//clamps to what the cpu supports, call before any plan is executed from another thread
+void fft_simd_use(fft_simd level) {
+	//the default goes first, so a later first use can never overwrite this choice
+	pthread_once(&fft_kernels_once, fft_kernels_default);
+	fft_kernels_selected = fft_kernels_for(level);
+}
+
+//the first call picks the default exactly once, even when plans are created from several threads at a time
+fft_kernels_t* fft_kernels() {
+	pthread_once(&fft_kernels_once, fft_kernels_default);
+	return &fft_kernels_selected;
+}
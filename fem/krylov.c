@@ -0,0 +1,485 @@
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include "util.h"
+#include "sparsemat.h"
+#include "precond.h"
+
+//y = A x for an operator the solvers only ever apply, so it never has to be formed: an element loop, a stencil
+//x and y do not alias
+typedef void (*krylov_apply_fn)(void* arg, const double* x, double* y);
+
+typedef struct {
+	unsigned n;
+	krylov_apply_fn apply;
+	void* arg;
+} krylov_op_t;
+
+//called once per iteration with the relative residual and the seconds since the solve started
+typedef void (*krylov_monitor_fn)(void* arg, unsigned iter, double residual, double seconds);
+
+//preconditioned conjugate gradient for spd systems. the workspace is allocated here once,
+//so a time loop can call cg_solve every step without touching the heap
+typedef struct {
+	krylov_op_t op;
+	precond_t* pre; //null for none
+
+	double tol; //on ||r||/||b||
+	unsigned max_iter;
+
+	krylov_monitor_fn monitor; //optional
+	void* monitor_arg;
+
+	double* r;
+	double* z;
+	double* p;
+	double* q;
+
+	unsigned iters; //of the last solve
+	double residual; //relative, of the last solve
+} cg_t;
+
+static double krylov_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec*1e-9;
+}
+
+static void krylov_csr_apply(void* arg, const double* x, double* y) {
+	csr_spmv(arg, x, y);
+}
+
+//a frozen matrix as an operator, a has to outlive it
+krylov_op_t krylov_csr(const csr_t* a) {
+	return (krylov_op_t){.n=a->nrows, .apply=krylov_csr_apply, .arg=(void*)a};
+}
+
+static void krylov_apply(const krylov_op_t* op, const double* x, double* y) {
+	op->apply(op->arg, x, y);
+}
+
+static double krylov_dot(const double* x, const double* y, unsigned n) {
+	double sum = 0;
+	for (unsigned i=0; i<n; i++) sum += x[i]*y[i];
+	return sum;
+}
+
+cg_t cg_new_op(krylov_op_t op, precond_t* pre, double tol, unsigned max_iter) {
+	cg_t cg = {.op=op, .pre=pre, .tol=tol, .max_iter=max_iter};
+	unsigned n = op.n ? op.n : 1;
+
+	cg.r = heap(sizeof(double)*n);
+	cg.z = heap(sizeof(double)*n);
+	cg.p = heap(sizeof(double)*n);
+	cg.q = heap(sizeof(double)*n);
+
+	return cg;
+}
+
+cg_t cg_new(const csr_t* a, precond_t* pre, double tol, unsigned max_iter) {
+	return cg_new_op(krylov_csr(a), pre, tol, max_iter);
+}
+
+//x holds the initial guess and gets the solution. 1 if the tolerance was reached within max_iter
+int cg_solve(cg_t* cg, const double* b, double* x) {
+	const krylov_op_t* op = &cg->op;
+	unsigned n = op->n;
+	double *r = cg->r, *z = cg->z, *p = cg->p, *q = cg->q;
+
+	cg->iters = 0;
+	double start = krylov_now();
+
+	double bnorm = sqrt(krylov_dot(b, b, n));
+	if (bnorm == 0) {
+		memset(x, 0, sizeof(double)*n);
+		cg->residual = 0;
+		return 1;
+	}
+
+	krylov_apply(op, x, r);
+	for (unsigned i=0; i<n; i++) r[i] = b[i] - r[i];
+
+	cg->residual = sqrt(krylov_dot(r, r, n))/bnorm;
+	if (cg->residual <= cg->tol) return 1;
+
+	if (cg->pre) precond_apply(cg->pre, r, z);
+	else memcpy(z, r, sizeof(double)*n);
+
+	memcpy(p, z, sizeof(double)*n);
+	double rz = krylov_dot(r, z, n);
+
+	while (cg->iters < cg->max_iter) {
+		krylov_apply(op, p, q);
+		double pq = krylov_dot(p, q, n);
+		if (pq <= 0) break; //not spd (or p vanished), nothing sensible left to do
+
+		double alpha = rz/pq;
+		for (unsigned i=0; i<n; i++) {
+			x[i] += alpha*p[i];
+			r[i] -= alpha*q[i];
+		}
+
+		cg->iters++;
+		cg->residual = sqrt(krylov_dot(r, r, n))/bnorm;
+		if (cg->monitor) cg->monitor(cg->monitor_arg, cg->iters, cg->residual, krylov_now() - start);
+		if (cg->residual <= cg->tol) return 1;
+
+		if (cg->pre) precond_apply(cg->pre, r, z);
+		else memcpy(z, r, sizeof(double)*n);
+
+		double rz_next = krylov_dot(r, z, n);
+		double beta = rz_next/rz;
+		rz = rz_next;
+
+		for (unsigned i=0; i<n; i++) p[i] = z[i] + beta*p[i];
+	}
+
+	return 0;
+}
+
+void cg_free(cg_t* cg) {
+	drop(cg->r);
+	drop(cg->z);
+	drop(cg->p);
+	drop(cg->q);
+}
+
+typedef enum {
+	gmres_mgs, //modified gram-schmidt, cheapest
+	gmres_householder //reflectors, keeps the basis orthogonal to rounding when mgs starts to lose it
+} gmres_ortho;
+
+//restarted gmres(m) with right preconditioning, so the residual it tracks is the true one
+typedef struct {
+	krylov_op_t op;
+	precond_t* pre; //null for none
+
+	double tol; //on ||r||/||b||
+	unsigned max_iter; //total over restarts
+	unsigned m; //restart length
+	gmres_ortho ortho;
+
+	krylov_monitor_fn monitor; //optional
+	void* monitor_arg;
+
+	double* v; //m+1 basis vectors, or householder vectors
+	double* h; //(m+1)*m hessenberg, column major
+	double* cs; //givens rotations
+	double* sn;
+	double* g; //rotated residual
+	double* w;
+	double* t;
+
+	unsigned iters;
+	double residual;
+} gmres_t;
+
+gmres_t gmres_new_op(krylov_op_t op, precond_t* pre, unsigned m, gmres_ortho ortho, double tol, unsigned max_iter) {
+	//m 0 would restart forever without an iteration, and a basis past n is no better than n
+	if (op.n && m > op.n) m = op.n;
+	if (m == 0) m = 1;
+
+	gmres_t gm = {.op=op, .pre=pre, .tol=tol, .max_iter=max_iter, .m=m, .ortho=ortho};
+	size_t n = op.n ? op.n : 1;
+
+	gm.v = heap(sizeof(double)*n*(m+1));
+	gm.h = heap(sizeof(double)*(m+1)*m);
+	gm.cs = heap(sizeof(double)*m);
+	gm.sn = heap(sizeof(double)*m);
+	gm.g = heap(sizeof(double)*(m+1));
+	gm.w = heap(sizeof(double)*n);
+	gm.t = heap(sizeof(double)*n);
+
+	return gm;
+}
+
+gmres_t gmres_new(const csr_t* a, precond_t* pre, unsigned m, gmres_ortho ortho, double tol, unsigned max_iter) {
+	return gmres_new_op(krylov_csr(a), pre, m, ortho, tol, max_iter);
+}
+
+//x -= 2 u (u.x) over [k, n), u is unit and zero below k
+static void gmres_reflect(const double* u, double* x, unsigned k, unsigned n) {
+	double d = 2.0*krylov_dot(u+k, x+k, n-k);
+	for (unsigned i=k; i<n; i++) x[i] -= d*u[i];
+}
+
+//reflector taking z[k..n) onto alpha e_k, returns alpha
+static double gmres_householder_vec(const double* z, double* u, unsigned k, unsigned n) {
+	double norm = sqrt(krylov_dot(z+k, z+k, n-k));
+	double alpha = z[k] > 0 ? -norm : norm;
+
+	memset(u, 0, sizeof(double)*k);
+	memcpy(u+k, z+k, sizeof(double)*(n-k));
+	u[k] -= alpha;
+
+	double un = sqrt(krylov_dot(u+k, u+k, n-k));
+	if (un > 0) for (unsigned i=k; i<n; i++) u[i] /= un;
+	return alpha;
+}
+
+//apply A M^-1 to v into w
+static void gmres_op(gmres_t* gm, const double* v, double* w) {
+	if (gm->pre) {
+		precond_apply(gm->pre, v, gm->t);
+		krylov_apply(&gm->op, gm->t, w);
+	} else {
+		krylov_apply(&gm->op, v, w);
+	}
+}
+
+//x holds the initial guess and gets the solution. 1 if the tolerance was reached within max_iter
+int gmres_solve(gmres_t* gm, const double* b, double* x) {
+	const krylov_op_t* op = &gm->op;
+	unsigned n = op->n, m = gm->m;
+	double *v = gm->v, *h = gm->h, *g = gm->g, *w = gm->w;
+
+	gm->iters = 0;
+	double start = krylov_now();
+
+	double bnorm = sqrt(krylov_dot(b, b, n));
+	if (bnorm == 0) {
+		memset(x, 0, sizeof(double)*n);
+		gm->residual = 0;
+		return 1;
+	}
+
+	while (1) {
+		krylov_apply(op, x, w);
+		for (unsigned i=0; i<n; i++) w[i] = b[i] - w[i];
+
+		double beta;
+		if (gm->ortho == gmres_householder) {
+			beta = gmres_householder_vec(w, v, 0, n);
+		} else {
+			beta = sqrt(krylov_dot(w, w, n));
+			for (unsigned i=0; i<n; i++) v[i] = w[i]/beta;
+		}
+
+		gm->residual = fabs(beta)/bnorm;
+		if (gm->residual <= gm->tol) return 1;
+		if (gm->iters >= gm->max_iter) return 0;
+
+		memset(g, 0, sizeof(double)*(m+1));
+		g[0] = beta;
+
+		unsigned k = 0;
+		while (k < m && gm->iters < gm->max_iter) {
+			double* hk = h + (size_t)k*(m+1);
+
+			if (gm->ortho == gmres_householder) {
+				//basis vector k is P_0..P_k e_k, built in the slot the next reflector goes into
+				//its image goes back through the reflectors in reverse
+				double* vn = v + (size_t)(k+1)*n;
+				memset(vn, 0, sizeof(double)*n);
+				vn[k] = 1;
+				for (unsigned j=k+1; j-- > 0;) gmres_reflect(v + (size_t)j*n, vn, j, n);
+
+				gmres_op(gm, vn, w);
+				for (unsigned j=0; j<=k; j++) gmres_reflect(v + (size_t)j*n, w, j, n);
+
+				for (unsigned j=0; j<=k; j++) hk[j] = w[j];
+				hk[k+1] = k+1 < n ? gmres_householder_vec(w, v + (size_t)(k+1)*n, k+1, n) : 0;
+			} else {
+				double* vk = v + (size_t)k*n;
+				double* vn = vk + n;
+				gmres_op(gm, vk, vn);
+
+				for (unsigned j=0; j<=k; j++) {
+					hk[j] = krylov_dot(vn, v + (size_t)j*n, n);
+					for (unsigned i=0; i<n; i++) vn[i] -= hk[j]*v[(size_t)j*n + i];
+				}
+
+				hk[k+1] = sqrt(krylov_dot(vn, vn, n));
+				if (hk[k+1] != 0) for (unsigned i=0; i<n; i++) vn[i] /= hk[k+1];
+			}
+
+			//previous rotations, then a new one zeroing the subdiagonal
+			for (unsigned j=0; j<k; j++) {
+				double t = gm->cs[j]*hk[j] + gm->sn[j]*hk[j+1];
+				hk[j+1] = -gm->sn[j]*hk[j] + gm->cs[j]*hk[j+1];
+				hk[j] = t;
+			}
+
+			double r = hypot(hk[k], hk[k+1]);
+			gm->cs[k] = r == 0 ? 1 : hk[k]/r;
+			gm->sn[k] = r == 0 ? 0 : hk[k+1]/r;
+			hk[k] = r;
+			hk[k+1] = 0;
+
+			g[k+1] = -gm->sn[k]*g[k];
+			g[k] = gm->cs[k]*g[k];
+
+			k++;
+			gm->iters++;
+			gm->residual = fabs(g[k])/bnorm;
+			if (gm->monitor) gm->monitor(gm->monitor_arg, gm->iters, gm->residual, krylov_now() - start);
+			if (gm->residual <= gm->tol || r == 0) break;
+		}
+
+		//back substitute the triangle into g, then x += M^-1 V y
+		for (unsigned i=k; i-- > 0;) {
+			double sum = g[i];
+			for (unsigned j=i+1; j<k; j++) sum -= h[(size_t)j*(m+1) + i]*g[j];
+			g[i] = h[(size_t)i*(m+1) + i] == 0 ? 0 : sum/h[(size_t)i*(m+1) + i];
+		}
+
+		memset(w, 0, sizeof(double)*n);
+		if (gm->ortho == gmres_householder) {
+			for (unsigned j=k; j-- > 0;) {
+				w[j] += g[j];
+				gmres_reflect(v + (size_t)j*n, w, j, n);
+			}
+		} else {
+			for (unsigned j=0; j<k; j++) {
+				for (unsigned i=0; i<n; i++) w[i] += g[j]*v[(size_t)j*n + i];
+			}
+		}
+
+		if (gm->pre) {
+			precond_apply(gm->pre, w, gm->t);
+			for (unsigned i=0; i<n; i++) x[i] += gm->t[i];
+		} else {
+			for (unsigned i=0; i<n; i++) x[i] += w[i];
+		}
+	}
+}
+
+void gmres_free(gmres_t* gm) {
+	drop(gm->v);
+	drop(gm->h);
+	drop(gm->cs);
+	drop(gm->sn);
+	drop(gm->g);
+	drop(gm->w);
+	drop(gm->t);
+}
+
+//right preconditioned bicgstab, short recurrences and fixed memory where gmres grows with m
+typedef struct {
+	krylov_op_t op;
+	precond_t* pre; //null for none
+
+	double tol; //on ||r||/||b||
+	unsigned max_iter;
+
+	krylov_monitor_fn monitor; //optional
+	void* monitor_arg;
+
+	double* r;
+	double* rhat;
+	double* p;
+	double* v;
+	double* s;
+	double* t;
+	double* y; //preconditioned p, then s
+
+	unsigned iters;
+	double residual;
+} bicgstab_t;
+
+bicgstab_t bicgstab_new_op(krylov_op_t op, precond_t* pre, double tol, unsigned max_iter) {
+	bicgstab_t bs = {.op=op, .pre=pre, .tol=tol, .max_iter=max_iter};
+	unsigned n = op.n ? op.n : 1;
+
+	bs.r = heap(sizeof(double)*n);
+	bs.rhat = heap(sizeof(double)*n);
+	bs.p = heap(sizeof(double)*n);
+	bs.v = heap(sizeof(double)*n);
+	bs.s = heap(sizeof(double)*n);
+	bs.t = heap(sizeof(double)*n);
+	bs.y = heap(sizeof(double)*n);
+
+	return bs;
+}
+
+bicgstab_t bicgstab_new(const csr_t* a, precond_t* pre, double tol, unsigned max_iter) {
+	return bicgstab_new_op(krylov_csr(a), pre, tol, max_iter);
+}
+
+//x holds the initial guess and gets the solution. 1 if the tolerance was reached within max_iter,
+//0 as well on a breakdown (rho, (rhat, v) or omega vanishing), x then holds the last iterate
+int bicgstab_solve(bicgstab_t* bs, const double* b, double* x) {
+	const krylov_op_t* op = &bs->op;
+	unsigned n = op->n;
+	double *r = bs->r, *rhat = bs->rhat, *p = bs->p, *v = bs->v, *s = bs->s, *t = bs->t, *y = bs->y;
+
+	bs->iters = 0;
+	double start = krylov_now();
+
+	double bnorm = sqrt(krylov_dot(b, b, n));
+	if (bnorm == 0) {
+		memset(x, 0, sizeof(double)*n);
+		bs->residual = 0;
+		return 1;
+	}
+
+	krylov_apply(op, x, r);
+	for (unsigned i=0; i<n; i++) r[i] = b[i] - r[i];
+
+	bs->residual = sqrt(krylov_dot(r, r, n))/bnorm;
+	if (bs->residual <= bs->tol) return 1;
+
+	memcpy(rhat, r, sizeof(double)*n);
+	memset(p, 0, sizeof(double)*n);
+	memset(v, 0, sizeof(double)*n);
+	double rho = 1, alpha = 1, omega = 1;
+
+	while (bs->iters < bs->max_iter) {
+		double rho_next = krylov_dot(rhat, r, n);
+		if (rho_next == 0) return 0;
+
+		double beta = (rho_next/rho)*(alpha/omega);
+		rho = rho_next;
+		for (unsigned i=0; i<n; i++) p[i] = r[i] + beta*(p[i] - omega*v[i]);
+
+		if (bs->pre) precond_apply(bs->pre, p, y);
+		else memcpy(y, p, sizeof(double)*n);
+
+		krylov_apply(op, y, v);
+		double rv = krylov_dot(rhat, v, n);
+		if (rv == 0) return 0;
+		alpha = rho/rv;
+
+		for (unsigned i=0; i<n; i++) {
+			s[i] = r[i] - alpha*v[i];
+			x[i] += alpha*y[i];
+		}
+
+		bs->iters++;
+		bs->residual = sqrt(krylov_dot(s, s, n))/bnorm;
+		if (bs->residual <= bs->tol) {
+			if (bs->monitor) bs->monitor(bs->monitor_arg, bs->iters, bs->residual, krylov_now() - start);
+			return 1;
+		}
+
+		if (bs->pre) precond_apply(bs->pre, s, y);
+		else memcpy(y, s, sizeof(double)*n);
+
+		krylov_apply(op, y, t);
+		double tt = krylov_dot(t, t, n);
+		omega = tt == 0 ? 0 : krylov_dot(t, s, n)/tt;
+
+		for (unsigned i=0; i<n; i++) {
+			x[i] += omega*y[i];
+			r[i] = s[i] - omega*t[i];
+		}
+
+		bs->residual = sqrt(krylov_dot(r, r, n))/bnorm;
+		if (bs->monitor) bs->monitor(bs->monitor_arg, bs->iters, bs->residual, krylov_now() - start);
+		if (bs->residual <= bs->tol) return 1;
+		if (omega == 0) return 0;
+	}
+
+	return 0;
+}
+
+void bicgstab_free(bicgstab_t* bs) {
+	drop(bs->r);
+	drop(bs->rhat);
+	drop(bs->p);
+	drop(bs->v);
+	drop(bs->s);
+	drop(bs->t);
+	drop(bs->y);
+}
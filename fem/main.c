@@ -1,3 +1,26 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+
 int main(int argc, char** argv) {
+	if (argc > 2 && strcmp(argv[1], "bench") == 0) {
+		if (strcmp(argv[2], "fft") == 0) bench_fft();
+		else if (strcmp(argv[2], "fft3") == 0) bench_fft3();
+		else if (strcmp(argv[2], "simd") == 0) bench_fft_simd();
+		else if (strcmp(argv[2], "prec") == 0) bench_fft_prec();
+		else if (strcmp(argv[2], "spmv") == 0) bench_spmv();
+		else if (strcmp(argv[2], "reorder") == 0) bench_reorder();
+		else if (strcmp(argv[2], "chol") == 0) bench_chol();
+		else if (strcmp(argv[2], "amg") == 0) bench_amg();
+		else if (strcmp(argv[2], "bsr") == 0) bench_bsr();
+		else if (strcmp(argv[2], "assemble") == 0) bench_assemble();
+		else if (strcmp(argv[2], "matfree") == 0) bench_matfree();
+		else if (strcmp(argv[2], "adjacency") == 0) bench_adjacency();
+		else if (strcmp(argv[2], "weld") == 0) bench_weld();
+		else if (strcmp(argv[2], "bvh") == 0) bench_bvh();
+		else fprintf(stderr, "unknown benchmark %s\n", argv[2]);
+	}
+
 	return 0;
 }
@@ -0,0 +1,56 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+#define MESH_ALIGN 64 //bytes, a cache line and so any vector width
+#define MESH_PAD 16 //floats, every array is padded to a multiple and zeroed past n
+
+//vertex positions as three separate arrays, what mesh kernels want when they run over vertices a vector at a
+//time. all three live in one aligned block, x then y then z, each stride floats long, so every array starts
+//aligned and loops may run to stride without a scalar tail
+typedef struct {
+	unsigned n; //vertices
+	unsigned stride; //floats per array
+	float* x, * y, * z;
+	void* block; //from heap, x starts at its first aligned byte
+} mesh_t;
+
+//n vertices at the origin
+mesh_t mesh_new(unsigned n) {
+	mesh_t m = {.n=n};
+	m.stride = n ? (n + MESH_PAD-1)/MESH_PAD*MESH_PAD : MESH_PAD;
+
+	//heap rather than aligned_alloc, so running out of memory fails the same way as everywhere else
+	m.block = heap(sizeof(float)*3*m.stride + MESH_ALIGN-1);
+	m.x = (float*)(((uintptr_t)m.block + MESH_ALIGN-1) & ~(uintptr_t)(MESH_ALIGN-1));
+	memset(m.x, 0, sizeof(float)*3*m.stride);
+	m.y = m.x + m.stride;
+	m.z = m.y + m.stride;
+	return m;
+}
+
+//vertex i from the float xyz at pos + (index ? index[i] : i)*stride bytes, the layout weld_new reads
+mesh_t mesh_from_strided(const void* pos, size_t stride, const unsigned* index, unsigned n) {
+	mesh_t m = mesh_new(n);
+
+	for (unsigned i=0; i<n; i++) {
+		const float* p = (const float*)((const char*)pos + (size_t)(index ? index[i] : i)*stride);
+		m.x[i] = p[0];
+		m.y[i] = p[1];
+		m.z[i] = p[2];
+	}
+
+	return m;
+}
+
+void mesh_get(const mesh_t* m, unsigned i, float p[3]) {
+	p[0] = m->x[i];
+	p[1] = m->y[i];
+	p[2] = m->z[i];
+}
+
+void mesh_free(mesh_t* m) {
+	drop(m->block);
+}
@@ -1,141 +1,196 @@
 #include <math.h>
+#include <string.h>
 
 #include "util.h"
 #include "field.c"
 #include "mat.h"
 #include "vector.h"
-
-#define PHYSICS_NORMAL_ANGLES 10
-
-typedef struct {
-	unsigned* edges; //ends with zero, +1
-} physics_adj_t;
+#include "reorder.h"
+#include "pool.h"
+#include "assemble.h"
+#include "weld.h"
+#include "bvh.h"
+#include "mesh.h"
 
 typedef struct {
-	vector_t vertices; //deduped vertices
-	map_t vertices_loc; //vec3 -> vertices
-	vector_t adjacent; //adjacent edges
+	mesh_t mesh; //deduped vertices
+	weld_t weld; //corner of elements -> vertices
+	reorder_graph_t adjacent; //vertex adjacency, sorted unique neighbours
 	vector_t tris;
 
-	float volume; //total vol
+	float volume; //total signed vol, positive when elements wind counterclockwise seen from outside
 
-	vector_t vert_volume; //vertex contribution to volume
+	vector_t vert_volume; //float per vertex, a third of every adjacent triangle's tetrahedron to the first vertex, sums to volume
+	vec3 centroid;
+	float inertia[3][3]; //about the centroid for unit density
 
-	vector_t normals[PHYSICS_NORMAL_ANGLES*PHYSICS_NORMAL_ANGLES]; //normal of hyperplane -> all triangles with normal within 180 degrees for raycasting
-	vector_t opposite; //intersections from normal
+	bvh_t bvh; //over tris, for raycasting
 } physics_obj_t;
 
-//rudimentary analysis
-physics_obj_t physics_obj(vector_t vertices, vector_t elements, unsigned pos_stride) {
-	physics_obj_t pobj;
-	pobj.vertices = vector_new(sizeof(vec3));
-	pobj.tris = vector_new(sizeof(unsigned)*3);
+#define PHYSICS_MASS_BLOCK 64 //triangles summed plainly before one compensated add into the totals
 
-	pobj.vertices_loc = map_new();
-	map_configure_uint96_key(&pobj.vertices_loc, sizeof(unsigned));
+//neumaier: the running error of a sum carried separately and added back at the end
+typedef struct {
+	double s, c;
+} physics_sum_t;
+
+//a select rather than a branch, the compiler turns it into blends
+static void physics_sum_add(physics_sum_t* sum, double x) {
+	double t = sum->s + x;
+	sum->c += fabs(sum->s) >= fabs(x) ? (sum->s - t) + x : (x - t) + sum->s;
+	sum->s = t;
+}
 
-	pobj.adjacent = vector_new(sizeof(physics_adj_t));
+static double physics_sum(const physics_sum_t* sum) {
+	return sum->s + sum->c;
+}
 
-	for (unsigned i=0; i<PHYSICS_NORMAL_ANGLES*PHYSICS_NORMAL_ANGLES; i++) {
-		pobj.normals[i] = vector_new(sizeof(unsigned));
+//volume integrals over the tetrahedra from a reference point to every triangle, the reference (the first vertex)
+//keeps the coordinates small so far off meshes don't cancel away. moments are relative to it
+//the totals are summed plainly over a block of triangles, the block partials then go into compensated sums
+typedef struct {
+	double ref[3];
+	physics_sum_t total[10]; //vol, first x y z, second xx yy zz xy yz zx
+	double block[10];
+	unsigned nblock; //triangles in block
+	physics_sum_t* vert; //per vertex
+} physics_mass_t;
+
+static void physics_mass_flush(physics_mass_t* m) {
+	for (unsigned k=0; k<10; k++) {
+		physics_sum_add(&m->total[k], m->block[k]);
+		m->block[k] = 0;
 	}
 
-	//tag vertices
-	for (unsigned i=2; i<elements.length; i+=3) {
-		unsigned v[3];
-		float* verts[3];
+	m->nblock = 0;
+}
 
-		//deref
-		for (char i2=0; i2<3; i2++) {
-			unsigned* elem = (unsigned*)vector_get(&elements, i-i2);
-			verts[i2] = (float*)((char*)vector_get(&vertices, *elem) + pos_stride);
-			map_insert_result res = map_insertcpy_noexist(&pobj.vertices_loc, verts[i2], &pobj.vertices.length);
-			if (!res.exists) {
-				vector_pushcpy(&pobj.vertices, verts[i2]);
-			}
+//one triangle: det = 6 vol of the tetrahedron (ref, a, b, c), its first moment det/24 (a+b+c) and its second
+//det/120 (sum v v^T + s s^T) with s = a+b+c. straight line into the block, only the per vertex thirds
+//scatter into compensated sums right away
+static void physics_mass_tri(physics_mass_t* m, const mesh_t* mesh, const unsigned v[3]) {
+	double a[3][3];
+	for (unsigned i=0; i<3; i++) {
+		a[i][0] = (double)mesh->x[v[i]] - m->ref[0];
+		a[i][1] = (double)mesh->y[v[i]] - m->ref[1];
+		a[i][2] = (double)mesh->z[v[i]] - m->ref[2];
+	}
 
-			v[i2] = *(unsigned*)res.val;
-		}
+	double det = a[0][0]*(a[1][1]*a[2][2] - a[1][2]*a[2][1])
+		+ a[0][1]*(a[1][2]*a[2][0] - a[1][0]*a[2][2])
+		+ a[0][2]*(a[1][0]*a[2][1] - a[1][1]*a[2][0]);
 
-		unsigned tri = pobj.tris.length;
-		vector_pushcpy(&pobj.tris, v);
+	double s[3] = {a[0][0] + a[1][0] + a[2][0], a[0][1] + a[1][1] + a[2][1], a[0][2] + a[1][2] + a[2][2]};
+	static const unsigned pi[6] = {0, 1, 2, 0, 1, 2}, pj[6] = {0, 1, 2, 1, 2, 0};
+
+	m->block[0] += det/6;
+	for (unsigned k=0; k<3; k++) m->block[1+k] += det/24*s[k];
+	for (unsigned k=0; k<6; k++) {
+		unsigned i = pi[k], j = pj[k];
+		double vv = a[0][i]*a[0][j] + a[1][i]*a[1][j] + a[2][i]*a[2][j];
+		m->block[4+k] += det/120*(vv + s[i]*s[j]);
+	}
+
+	for (unsigned i=0; i<3; i++) physics_sum_add(&m->vert[v[i]], det/18);
+	if (++m->nblock == PHYSICS_MASS_BLOCK) physics_mass_flush(m);
+}
+
+//totals into the object: centroid from the first moment, the second moved from the reference to the centroid
+//and turned into the inertia tensor trace(C) I - C
+static void physics_mass_finish(physics_mass_t* m, physics_obj_t* pobj) {
+	physics_mass_flush(m);
+	double vol = physics_sum(&m->total[0]), d[3], c[3][3];
+	pobj->volume = (float)vol;
+
+	for (unsigned k=0; k<3; k++) {
+		d[k] = vol != 0 ? physics_sum(&m->total[1+k])/vol : 0;
+		pobj->centroid[k] = (float)(m->ref[k] + d[k]);
+	}
 
-		//insert adjacent
-		unsigned v_adj[3] = {0};
-
-		for (char i2=0; i2<3; i2++) {
-			char exists;
-			physics_adj_t* adj = vector_setget(&pobj.adjacent, v[i2], &exists);
-
-			//hopefully unrolled lmao
-			for (char i3 = 0; i3 < 3; i3++) {
-				if (i3 == i2) continue;
-				v_adj[i3 > i2 ? i3 - 1 : i3] = v[i3] + 1;
-			}
-
-			if (!exists) {
-				adj->edges = heapcpy(sizeof(unsigned) * 3, v_adj);
-			} else {
-				unsigned* x = adj->edges;
-				do {
-					x++;
-
-					if (*x == v_adj[0]) {
-						v_adj[0] = 0;
-						if (v_adj[1] == 0) break;
-					}
-
-					if (*x == v_adj[1]) {
-						v_adj[1] = 0;
-						if (v_adj[0] == 0) break;
-					}
-				} while (*x != 0);
-
-				if (v_adj[0] == 0 && v_adj[1] == 0) continue;
-				unsigned count = x - adj->edges;
-				if (v_adj[0]) count++;
-				if (v_adj[1]) count++;
-
-				adj->edges = resize(adj->edges, sizeof(unsigned) * count);
-				adj->edges[count - 1] = 0;
-
-				if (v_adj[0]) {
-					adj->edges[count - 2] = v_adj[0];
-					count--;
-				}
-
-				if (v_adj[1]) adj->edges[count - 2] = v_adj[1];
-			}
-		}
-
-		//what the fuck did i just write
-		//anyways
-		vec3 v12, v13;
-		vec3sub(verts[1], verts[0], v12);
-		vec3sub(verts[2], verts[0], v13);
-
-		vec3 normal;
-		vec3cross(v12, v13, normal);
-		vec3normalize(normal);
-
-		float y_scale = sqrtf(1-normal[1]*normal[1]);
-		normal[0] /= y_scale;
-		normal[2] /= y_scale;
-
-		float y = asinf(normal[1]) / M_PI_2;
-		float x = asinf(normal[2]) / M_PI_2;
-
-		//insert into hemisphere
-		for (int off=-PHYSICS_NORMAL_ANGLES/2 - 1; off<=PHYSICS_NORMAL_ANGLES/2 + 1; off++) {
-			vector_pushcpy(&pobj.normals[((int)(y*PHYSICS_NORMAL_ANGLES + x) + off) % PHYSICS_NORMAL_ANGLES], &tri);
-		}
+	static const unsigned pi[6] = {0, 1, 2, 0, 1, 2}, pj[6] = {0, 1, 2, 1, 2, 0};
+	for (unsigned k=0; k<6; k++) {
+		unsigned i = pi[k], j = pj[k];
+		c[i][j] = c[j][i] = physics_sum(&m->total[4+k]) - vol*d[i]*d[j];
+	}
 
+	double tr = c[0][0] + c[1][1] + c[2][2];
+	for (unsigned i=0; i<3; i++) {
+		for (unsigned j=0; j<3; j++) pobj->inertia[i][j] = (float)((i == j ? tr : 0) - c[i][j]);
+	}
 
+	pobj->vert_volume = vector_new(sizeof(float));
+	for (unsigned i=0; i<pobj->mesh.n; i++) {
+		float x = (float)physics_sum(&m->vert[i]);
+		vector_pushcpy(&pobj->vert_volume, &x);
 	}
+}
+
+//rudimentary analysis. corners closer than the weld_eps grid (0 for bit exact) become one vertex, numbered in
+//corner order, the weld runs on the pool
+physics_obj_t physics_obj(vector_t vertices, vector_t elements, unsigned pos_stride, float weld_eps, pool_t* pool) {
+	physics_obj_t pobj;
+	pobj.tris = vector_new(sizeof(unsigned)*3);
+
+	unsigned corners = elements.length - elements.length%3;
+	const char* pos = vertices.length ? (char*)vector_get(&vertices, 0) + pos_stride : NULL;
+	pobj.weld = weld_new(pos, vertices.size, corners ? vector_get(&elements, 0) : NULL, corners, weld_eps, pool);
+
+	//input vertex of each vertex's first corner, gathered out of the strided input straight into soa
+	unsigned* src = heap(sizeof(unsigned)*(pobj.weld.n ? pobj.weld.n : 1));
+	for (unsigned i=0; i<pobj.weld.n; i++) src[i] = *(unsigned*)vector_get(&elements, pobj.weld.first[i]);
+	pobj.mesh = mesh_from_strided(pos, vertices.size, src, pobj.weld.n);
+	drop(src);
+
+	//tag vertices, integrating volume and moments as the triangles come so the mesh is walked once
+	physics_mass_t mass = {0};
+	mass.vert = heap(sizeof(physics_sum_t)*(pobj.weld.n ? pobj.weld.n : 1));
+	memset(mass.vert, 0, sizeof(physics_sum_t)*pobj.weld.n);
+	if (pobj.weld.n) {
+		float p[3];
+		mesh_get(&pobj.mesh, 0, p);
+		for (unsigned k=0; k<3; k++) mass.ref[k] = p[k];
+	}
+
+	for (unsigned i=2; i<elements.length; i+=3) {
+		unsigned v[3];
+		for (char i2=0; i2<3; i2++) v[i2] = pobj.weld.remap[i-i2];
+		vector_pushcpy(&pobj.tris, v);
+		physics_mass_tri(&mass, &pobj.mesh, (unsigned[]){v[2], v[1], v[0]}); //element order, tris runs the other way
+	}
+
+	physics_mass_finish(&mass, &pobj);
+	drop(mass.vert);
+
+	//one pass over the finished triangle list instead of growing an edge list per vertex on every triangle
+	const unsigned* tris = pobj.tris.length ? vector_get(&pobj.tris, 0) : NULL;
+	pobj.adjacent = reorder_graph_tris(tris, pobj.tris.length, pobj.mesh.n);
+	pobj.bvh = bvh_new(&pobj.mesh, tris, pobj.tris.length, pool);
 
 	return pobj;
 }
 
+//vertex graph of the mesh for reorder_rcm / reorder_nd, vertex i is row i of anything assembled over it
+//a copy, so the orderings can be freed independently of the object
+reorder_graph_t physics_graph(physics_obj_t* pobj) {
+	reorder_graph_t* adj = &pobj->adjacent;
+	reorder_graph_t g = {.n=adj->n};
+	g.ptr = heapcpy(sizeof(unsigned)*(adj->n+1), adj->ptr);
+	g.adj = heapcpy(sizeof(unsigned)*(adj->ptr[adj->n] ? adj->ptr[adj->n] : 1), adj->adj);
+	return g;
+}
+
+//assembly over the triangles, run it with assembly_laplace_tri and &pobj->mesh for the surface laplacian
+assembly_t physics_assembly(physics_obj_t* pobj, pool_t* pool) {
+	const unsigned* tris = pobj->tris.length ? vector_get(&pobj->tris, 0) : NULL;
+	return assembly_new(pobj->mesh.n, tris, pobj->tris.length, 3, pool);
+}
+
+//the same without the matrix, for assembly_apply through cg_new_op when the stiffness matrix would not fit
+assembly_t physics_assembly_matfree(physics_obj_t* pobj, pool_t* pool) {
+	const unsigned* tris = pobj->tris.length ? vector_get(&pobj->tris, 0) : NULL;
+	return assembly_matfree_new(pobj->mesh.n, tris, pobj->tris.length, 3, pool);
+}
+
 //vector_t convex_obj(object_t* obj) {
 //	vector_t convex = vector_new(sizeof(vec3));
 //
@@ -0,0 +1,153 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "util.h"
+
+//fn gets [begin, end) of the job and the index of the worker running it, 0 is the calling thread
+typedef void (*pool_fn)(void* arg, unsigned worker, unsigned begin, unsigned end);
+
+struct pool;
+
+typedef struct {
+	struct pool* pool;
+	unsigned id;
+} pool_worker_t;
+
+//fixed set of threads for parallel for loops. heap allocated since workers hold on to it
+typedef struct pool {
+	unsigned nthreads; //including the caller
+	pthread_t* threads;
+	pool_worker_t* workers;
+
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t done;
+
+	pool_fn fn;
+	void* arg;
+	unsigned count;
+	unsigned grain;
+
+	atomic_uint next; //start of the next unclaimed chunk
+	unsigned active; //background workers still inside the current job
+	unsigned generation;
+	int quit;
+} pool_t;
+
+static void pool_drain(pool_t* pool, unsigned id) {
+	while (1) {
+		unsigned begin = atomic_fetch_add(&pool->next, pool->grain);
+		if (begin >= pool->count) break;
+
+		unsigned end = begin + pool->grain < pool->count ? begin + pool->grain : pool->count;
+		pool->fn(pool->arg, id, begin, end);
+	}
+}
+
+static void* pool_thread(void* arg) {
+	pool_worker_t* worker = arg;
+	pool_t* pool = worker->pool;
+	unsigned seen = 0;
+
+	pthread_mutex_lock(&pool->lock);
+
+	while (1) {
+		while (pool->generation == seen && !pool->quit) pthread_cond_wait(&pool->work, &pool->lock);
+		if (pool->quit) break;
+
+		seen = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		pool_drain(pool, worker->id);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->active == 0) pthread_cond_signal(&pool->done);
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+//0 threads means one per online core
+pool_t* pool_new(unsigned nthreads) {
+	if (nthreads == 0) {
+		long cores = sysconf(_SC_NPROCESSORS_ONLN);
+		nthreads = cores > 0 ? (unsigned)cores : 1;
+	}
+
+	pool_t* pool = heap(sizeof(pool_t));
+	*pool = (pool_t){.nthreads=nthreads};
+	atomic_init(&pool->next, 0);
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	pool->threads = heap(sizeof(pthread_t)*nthreads);
+	pool->workers = heap(sizeof(pool_worker_t)*nthreads);
+
+	for (unsigned i=1; i<nthreads; i++) {
+		pool->workers[i] = (pool_worker_t){.pool=pool, .id=i};
+		pthread_create(&pool->threads[i], NULL, pool_thread, &pool->workers[i]);
+	}
+
+	return pool;
+}
+
+unsigned pool_threads(pool_t* pool) {
+	return pool ? pool->nthreads : 1;
+}
+
+//runs fn over [0, count) in chunks of grain and returns once every chunk is done
+//a null pool runs everything inline on worker 0
+void pool_run(pool_t* pool, pool_fn fn, void* arg, unsigned count, unsigned grain) {
+	if (count == 0) return;
+	if (grain == 0) grain = 1;
+
+	if (!pool || pool->nthreads == 1 || count <= grain) {
+		fn(arg, 0, 0, count);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->fn = fn;
+	pool->arg = arg;
+	pool->count = count;
+	pool->grain = grain;
+	atomic_store(&pool->next, 0);
+	pool->active = pool->nthreads - 1;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	pool_drain(pool, 0);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->active) pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+//chunk size giving each thread a few chunks to balance with
+unsigned pool_grain(pool_t* pool, unsigned count) {
+	unsigned chunks = pool_threads(pool)*4;
+	unsigned grain = (count + chunks - 1)/chunks;
+	return grain ? grain : 1;
+}
+
+void pool_free(pool_t* pool) {
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (unsigned i=1; i<pool->nthreads; i++) pthread_join(pool->threads[i], NULL);
+
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->work);
+	pthread_cond_destroy(&pool->done);
+
+	drop(pool->threads);
+	drop(pool->workers);
+	drop(pool);
+}
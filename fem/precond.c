@@ -0,0 +1,287 @@
+#include <math.h>
+#include <string.h>
+
+#include "util.h"
+#include "sparsemat.h"
+#include "amg.h"
+
+#define PRECOND_SHIFTS 24 //ic0, ilu0: tries before giving up, the last shift is about 4000 times the largest diagonal
+
+typedef enum {
+	precond_none,
+	precond_jacobi,
+	precond_sgs, //symmetric gauss-seidel
+	precond_ic0, //incomplete cholesky on the pattern of the lower triangle
+	precond_ilu0, //incomplete lu on the pattern of a, for non symmetric systems
+	precond_amg //one smoothed aggregation v-cycle, iteration counts stay flat as poisson meshes refine
+} precond_kind;
+
+//z = M^-1 r for a frozen matrix, everything is factored once in precond_new
+typedef struct {
+	precond_kind kind;
+	const csr_t* a; //null for a jacobi from a bare diagonal
+	unsigned n;
+
+	double* inv_diag; //jacobi, sgs
+	unsigned* diag; //sgs: position of each row's diagonal in a, ilu0: in lu
+	csr_t l; //ic0: lower factor with the diagonal last in each row
+	csr_t lu; //ilu0: unit lower and upper factors sharing the pattern of a
+	double shift; //ic0, ilu0: diagonal shift it took to factor without breakdown, in units of the largest |a_ii|
+	int ok; //0 on a missing or zero diagonal or a factorization that broke down at every shift, applies as none
+	amg_t amg; //amg: the hierarchy, built once here
+} precond_t;
+
+//largest |a_ii|, or largest |a_ij| when the diagonal is all zeros, what the factorization shifts scale with
+static double precond_shift_scale(const csr_t* a, const unsigned* diag) {
+	double scale = 0;
+	for (unsigned r=0; r<a->nrows; r++) scale = fmax(scale, fabs(a->val[diag[r]]));
+	for (unsigned i=0; i<a->nnz && scale == 0; i++) scale = fmax(scale, fabs(a->val[i]));
+	return scale;
+}
+
+//0, then 1e-3 doubling each try
+static double precond_shift(unsigned try) {
+	return try ? ldexp(1e-3, (int)try - 1) : 0;
+}
+
+//row by row, l_ij = (a_ij - sum_k<j l_ik l_jk)/l_jj over the lower pattern of a with shift added to the diagonal
+//0 on a non positive pivot
+static int precond_ic0_factor(precond_t* p, double shift) {
+	const csr_t* a = p->a;
+	csr_t* l = &p->l;
+
+	for (unsigned r=0; r<a->nrows; r++) {
+		unsigned out = l->row_ptr[r];
+
+		for (unsigned i=a->row_ptr[r]; i<a->row_ptr[r+1] && a->col[i] <= r; i++) {
+			unsigned c = a->col[i];
+
+			//sorted merge of rows r and c over the columns already written, both end at their diagonal
+			double sum = a->val[i] + (c == r ? shift : 0);
+			unsigned ir = l->row_ptr[r], ic = l->row_ptr[c];
+			unsigned er = out, ec = c == r ? out : l->row_ptr[c+1] - 1;
+			while (ir < er && ic < ec) {
+				if (l->col[ir] < l->col[ic]) ir++;
+				else if (l->col[ir] > l->col[ic]) ic++;
+				else sum -= l->val[ir++]*l->val[ic++];
+			}
+
+			if (c == r) {
+				if (!(sum > 0)) return 0;
+				l->val[out] = sqrt(sum);
+			} else {
+				l->val[out] = sum/l->val[l->row_ptr[c+1] - 1];
+			}
+
+			out++;
+		}
+	}
+
+	return 1;
+}
+
+static int precond_ic0_build(precond_t* p) {
+	const csr_t* a = p->a;
+	csr_t* l = &p->l;
+	*l = (csr_t){.nrows=a->nrows, .ncols=a->ncols};
+
+	l->row_ptr = heap(sizeof(unsigned)*(a->nrows+1));
+	l->row_ptr[0] = 0;
+	for (unsigned r=0; r<a->nrows; r++) {
+		unsigned cnt = 0;
+		for (unsigned i=a->row_ptr[r]; i<a->row_ptr[r+1] && a->col[i] <= r; i++) cnt++;
+		l->row_ptr[r+1] = l->row_ptr[r] + cnt;
+	}
+
+	l->nnz = l->row_ptr[a->nrows];
+	l->col = heap(sizeof(unsigned)*(l->nnz ? l->nnz : 1));
+	l->val = heap(sizeof(double)*(l->nnz ? l->nnz : 1));
+
+	for (unsigned r=0; r<a->nrows; r++) {
+		unsigned out = l->row_ptr[r];
+		for (unsigned i=a->row_ptr[r]; i<a->row_ptr[r+1] && a->col[i] <= r; i++) l->col[out++] = a->col[i];
+	}
+
+	//spd matrices can still break down incomplete factorization, shift the diagonal up until it goes through
+	//additive, so zero and negative diagonals get somewhere too
+	double scale = precond_shift_scale(a, p->diag);
+	for (unsigned t=0; t<PRECOND_SHIFTS && scale > 0; t++) {
+		p->shift = precond_shift(t);
+		if (precond_ic0_factor(p, p->shift*scale)) return 1;
+	}
+
+	csr_free(l);
+	return 0;
+}
+
+//ikj elimination restricted to the pattern, pos maps a column to its slot in the current row. 0 on a zero pivot
+static int precond_ilu0_factor(precond_t* p, double shift, unsigned* pos) {
+	const csr_t* a = p->a;
+	csr_t* lu = &p->lu;
+
+	memcpy(lu->val, a->val, sizeof(double)*a->nnz);
+	for (unsigned r=0; r<a->nrows; r++) lu->val[p->diag[r]] += shift;
+
+	for (unsigned r=0; r<a->nrows; r++) {
+		unsigned begin = lu->row_ptr[r], end = lu->row_ptr[r+1];
+		for (unsigned i=begin; i<end; i++) pos[lu->col[i]] = i;
+
+		for (unsigned i=begin; i<p->diag[r]; i++) {
+			unsigned k = lu->col[i];
+			double lik = lu->val[i] /= lu->val[p->diag[k]];
+
+			for (unsigned j=p->diag[k]+1; j<lu->row_ptr[k+1]; j++) {
+				unsigned at = pos[lu->col[j]];
+				if (at != (unsigned)-1) lu->val[at] -= lik*lu->val[j];
+			}
+		}
+
+		for (unsigned i=begin; i<end; i++) pos[lu->col[i]] = (unsigned)-1;
+
+		double piv = lu->val[p->diag[r]];
+		if (piv == 0 || !isfinite(piv)) return 0;
+	}
+
+	return 1;
+}
+
+static int precond_ilu0_build(precond_t* p) {
+	const csr_t* a = p->a;
+	csr_t* lu = &p->lu;
+	*lu = *a;
+
+	lu->row_ptr = heapcpy(sizeof(unsigned)*(a->nrows+1), a->row_ptr);
+	lu->col = heapcpy(sizeof(unsigned)*(a->nnz ? a->nnz : 1), a->col);
+	lu->val = heap(sizeof(double)*(a->nnz ? a->nnz : 1));
+
+	unsigned* pos = heap(sizeof(unsigned)*(a->ncols ? a->ncols : 1));
+	memset(pos, 0xff, sizeof(unsigned)*a->ncols);
+
+	//as for ic0, saddle point blocks come in with exact zeros on the diagonal
+	double scale = precond_shift_scale(a, p->diag);
+	int ok = 0;
+	for (unsigned t=0; t<PRECOND_SHIFTS && scale > 0 && !ok; t++) {
+		p->shift = precond_shift(t);
+		ok = precond_ilu0_factor(p, p->shift*scale, pos);
+	}
+
+	drop(pos);
+	if (!ok) csr_free(lu);
+	return ok;
+}
+
+//a has to stay alive and unchanged for as long as the preconditioner is used
+//all but none need every diagonal entry present, jacobi and sgs nonzero, ic0 additionally a symmetric
+//matrix. check ok: a preconditioner that could not be built is left as none rather than applying garbage
+precond_t precond_new(const csr_t* a, precond_kind kind) {
+	precond_t p = {.kind=kind, .a=a, .n=a->nrows, .ok=1};
+
+	if (kind == precond_jacobi || kind == precond_sgs || kind == precond_ic0 || kind == precond_ilu0) {
+		p.diag = csr_diag(a);
+		p.ok = p.diag != NULL;
+	}
+
+	if (p.ok && (kind == precond_jacobi || kind == precond_sgs)) {
+		p.inv_diag = heap(sizeof(double)*(a->nrows ? a->nrows : 1));
+		for (unsigned r=0; r<a->nrows && p.ok; r++) {
+			p.ok = a->val[p.diag[r]] != 0;
+			p.inv_diag[r] = 1.0/a->val[p.diag[r]];
+		}
+	}
+
+	if (p.ok && kind == precond_ic0) p.ok = precond_ic0_build(&p);
+	if (p.ok && kind == precond_ilu0) p.ok = precond_ilu0_build(&p);
+	if (kind == precond_amg) {
+		p.amg = amg_new(a);
+		p.ok = p.amg.ok;
+	}
+
+	if (!p.ok) {
+		drop(p.diag);
+		drop(p.inv_diag);
+		p = (precond_t){.kind=precond_none, .a=a, .n=a->nrows};
+	}
+
+	return p;
+}
+
+//jacobi for operators that are never assembled, diag is copied and has no zeros
+precond_t precond_diag_new(unsigned n, const double* diag) {
+	precond_t p = {.kind=precond_jacobi, .n=n, .ok=1};
+	p.inv_diag = heap(sizeof(double)*(n ? n : 1));
+	for (unsigned r=0; r<n; r++) p.inv_diag[r] = 1.0/diag[r];
+	return p;
+}
+
+//z and r may not alias
+void precond_apply(precond_t* p, const double* r, double* z) {
+	const csr_t* a = p->a;
+	unsigned n = p->n;
+
+	switch (p->kind) {
+		case precond_none: memcpy(z, r, sizeof(double)*n); break;
+		case precond_jacobi: {
+			for (unsigned i=0; i<n; i++) z[i] = r[i]*p->inv_diag[i];
+			break;
+		}
+		case precond_sgs: {
+			//(D+L) D^-1 (D+U) z = r as a forward then a backward sweep
+			for (unsigned i=0; i<n; i++) {
+				double sum = r[i];
+				for (unsigned k=a->row_ptr[i]; k<p->diag[i]; k++) sum -= a->val[k]*z[a->col[k]];
+				z[i] = sum*p->inv_diag[i];
+			}
+
+			for (unsigned i=n; i-- > 0;) {
+				double sum = 0;
+				for (unsigned k=p->diag[i]+1; k<a->row_ptr[i+1]; k++) sum += a->val[k]*z[a->col[k]];
+				z[i] -= sum*p->inv_diag[i];
+			}
+
+			break;
+		}
+		case precond_ic0: {
+			const csr_t* l = &p->l;
+			for (unsigned i=0; i<n; i++) {
+				double sum = r[i];
+				unsigned d = l->row_ptr[i+1] - 1;
+				for (unsigned k=l->row_ptr[i]; k<d; k++) sum -= l->val[k]*z[l->col[k]];
+				z[i] = sum/l->val[d];
+			}
+
+			//L^T from the rows of L, scattering each solved entry into the ones above it
+			for (unsigned i=n; i-- > 0;) {
+				unsigned d = l->row_ptr[i+1] - 1;
+				z[i] /= l->val[d];
+				for (unsigned k=l->row_ptr[i]; k<d; k++) z[l->col[k]] -= l->val[k]*z[i];
+			}
+
+			break;
+		}
+		case precond_ilu0: {
+			const csr_t* lu = &p->lu;
+			for (unsigned i=0; i<n; i++) {
+				double sum = r[i];
+				for (unsigned k=lu->row_ptr[i]; k<p->diag[i]; k++) sum -= lu->val[k]*z[lu->col[k]];
+				z[i] = sum;
+			}
+
+			for (unsigned i=n; i-- > 0;) {
+				double sum = z[i];
+				for (unsigned k=p->diag[i]+1; k<lu->row_ptr[i+1]; k++) sum -= lu->val[k]*z[lu->col[k]];
+				z[i] = sum/lu->val[p->diag[i]];
+			}
+
+			break;
+		}
+		case precond_amg: amg_vcycle(&p->amg, r, z); break;
+	}
+}
+
+void precond_free(precond_t* p) {
+	drop(p->inv_diag);
+	drop(p->diag);
+	if (p->kind == precond_ic0) csr_free(&p->l);
+	if (p->kind == precond_ilu0) csr_free(&p->lu);
+	if (p->kind == precond_amg) amg_free(&p->amg);
+}
@@ -0,0 +1,449 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "vector.h"
+#include "hashtable.h"
+#include "sparsemat.h"
+
+//subgraphs this small are left in the order they come, their block of the factor is dense either way
+#define REORDER_LEAF 64
+
+//symmetric adjacency without self loops, vertex v's neighbours are adj[ptr[v]..ptr[v+1])
+typedef struct {
+	unsigned n;
+	unsigned* ptr;
+	unsigned* adj;
+} reorder_graph_t;
+
+//symmetric permutation, perm maps a new index to the old one and iperm back
+typedef struct {
+	unsigned n;
+	unsigned* perm;
+	unsigned* iperm;
+} reorder_t;
+
+//pattern of a + a^T minus the diagonal, a has to be square
+reorder_graph_t reorder_graph_csr(const csr_t* a) {
+	csr_t t = csr_transpose(a);
+	reorder_graph_t g = {.n=a->nrows};
+	g.ptr = heap(sizeof(unsigned)*(g.n+1));
+	g.adj = heap(sizeof(unsigned)*(a->nnz ? 2*a->nnz : 1));
+
+	//both rows are sorted, merge them
+	g.ptr[0] = 0;
+	unsigned out = 0;
+	for (unsigned r=0; r<g.n; r++) {
+		unsigned i = a->row_ptr[r], ie = a->row_ptr[r+1];
+		unsigned j = t.row_ptr[r], je = t.row_ptr[r+1];
+
+		while (i < ie || j < je) {
+			unsigned c;
+			if (j == je || (i < ie && a->col[i] < t.col[j])) c = a->col[i++];
+			else if (i == ie || t.col[j] < a->col[i]) c = t.col[j++];
+			else c = a->col[i++], j++;
+
+			if (c != r) g.adj[out++] = c;
+		}
+
+		g.ptr[r+1] = out;
+	}
+
+	g.adj = resize(g.adj, sizeof(unsigned)*(out ? out : 1));
+	csr_free(&t);
+	return g;
+}
+
+static int reorder_cmp(const void* a, const void* b) {
+	unsigned x = *(const unsigned*)a, y = *(const unsigned*)b;
+	return (x > y) - (x < y);
+}
+
+//vertex graph of a triangle mesh, 3 indices per triangle below n. two passes over the triangles, counting
+//then filling one flat array, after which each vertex sorts its few neighbours and drops repeats in place
+reorder_graph_t reorder_graph_tris(const unsigned* tris, unsigned ntris, unsigned n) {
+	reorder_graph_t g = {.n=n};
+	g.ptr = heap(sizeof(unsigned)*(n+1));
+	memset(g.ptr, 0, sizeof(unsigned)*(n+1));
+
+	for (size_t i=0; i<(size_t)ntris*3; i++) g.ptr[tris[i]+1] += 2;
+	for (unsigned v=0; v<n; v++) g.ptr[v+1] += g.ptr[v];
+
+	unsigned* fill = heapcpy(sizeof(unsigned)*(n ? n : 1), g.ptr);
+	g.adj = heap(sizeof(unsigned)*(g.ptr[n] ? g.ptr[n] : 1));
+
+	for (unsigned t=0; t<ntris; t++) {
+		const unsigned* tri = tris + (size_t)t*3;
+		for (unsigned i=0; i<3; i++) {
+			unsigned v = tri[i];
+			g.adj[fill[v]++] = tri[(i+1)%3];
+			g.adj[fill[v]++] = tri[(i+2)%3];
+		}
+	}
+
+	drop(fill);
+
+	//rows hold each neighbour about twice, sorting first leaves the repeats adjacent
+	unsigned out = 0;
+	for (unsigned v=0; v<n; v++) {
+		unsigned begin = g.ptr[v], end = g.ptr[v+1];
+		unsigned* row = g.adj + begin;
+		unsigned len = end - begin;
+
+		if (len > 32) {
+			qsort(row, len, sizeof(unsigned), reorder_cmp);
+		} else {
+			for (unsigned i=1; i<len; i++) {
+				unsigned c = row[i], j = i;
+				for (; j>0 && row[j-1] > c; j--) row[j] = row[j-1];
+				row[j] = c;
+			}
+		}
+
+		g.ptr[v] = out;
+		for (unsigned i=begin; i<end; i++) {
+			unsigned u = g.adj[i];
+			if (u == v || (out > g.ptr[v] && g.adj[out-1] == u)) continue;
+			g.adj[out++] = u;
+		}
+	}
+
+	g.ptr[n] = out;
+	g.adj = resize(g.adj, sizeof(unsigned)*(out ? out : 1));
+	return g;
+}
+
+void reorder_graph_free(reorder_graph_t* g) {
+	drop(g->ptr);
+	drop(g->adj);
+}
+
+static reorder_t reorder_new(unsigned n) {
+	reorder_t p = {.n=n};
+	p.perm = heap(sizeof(unsigned)*(n ? n : 1));
+	p.iperm = heap(sizeof(unsigned)*(n ? n : 1));
+	return p;
+}
+
+static void reorder_invert(reorder_t* p) {
+	for (unsigned i=0; i<p->n; i++) p->iperm[p->perm[i]] = i;
+}
+
+//the identity, for comparing against or for a caller that fills perm itself and calls reorder_invert
+reorder_t reorder_identity(unsigned n) {
+	reorder_t p = reorder_new(n);
+	for (unsigned i=0; i<n; i++) p.perm[i] = i;
+	reorder_invert(&p);
+	return p;
+}
+
+//breadth first from root over the vertices with part[v] == id, which all need level -1 on entry
+//order gets the visit order and level the depth. returns the count reached, *depth the number of levels
+static unsigned reorder_bfs(const reorder_graph_t* g, const unsigned* part, unsigned id, unsigned root,
+		unsigned* order, unsigned* level, unsigned* depth) {
+	unsigned head = 0, tail = 0;
+	order[tail++] = root;
+	level[root] = 0;
+
+	while (head < tail) {
+		unsigned v = order[head++];
+		for (unsigned i=g->ptr[v]; i<g->ptr[v+1]; i++) {
+			unsigned u = g->adj[i];
+			if (part[u] != id || level[u] != (unsigned)-1) continue;
+
+			level[u] = level[v] + 1;
+			order[tail++] = u;
+		}
+	}
+
+	*depth = level[order[tail-1]] + 1;
+	return tail;
+}
+
+static void reorder_unlevel(const unsigned* order, unsigned cnt, unsigned* level) {
+	for (unsigned i=0; i<cnt; i++) level[order[i]] = (unsigned)-1;
+}
+
+//george-liu: restart from the lowest degree vertex of the last level until the depth stops growing
+//the root it settles on starts long, narrow level structures. returns it with its levels left in order/level
+static unsigned reorder_peripheral(const reorder_graph_t* g, const unsigned* part, unsigned id, unsigned root,
+		unsigned* order, unsigned* level, unsigned* cnt, unsigned* depth) {
+	*cnt = reorder_bfs(g, part, id, root, order, level, depth);
+
+	for (;;) {
+		unsigned best = root, best_deg = (unsigned)-1;
+		for (unsigned i=*cnt; i-- > 0 && level[order[i]] == *depth-1;) {
+			unsigned v = order[i], deg = g->ptr[v+1] - g->ptr[v];
+			if (deg < best_deg) best = v, best_deg = deg;
+		}
+
+		if (best == root) return root;
+		reorder_unlevel(order, *cnt, level);
+
+		//as deep as root is as good a start, keeping it saves redoing root's search
+		unsigned next_depth;
+		*cnt = reorder_bfs(g, part, id, best, order, level, &next_depth);
+		if (next_depth < *depth) {
+			reorder_unlevel(order, *cnt, level);
+			*cnt = reorder_bfs(g, part, id, root, order, level, depth);
+			return root;
+		}
+
+		root = best;
+		if (next_depth == *depth) return root;
+		*depth = next_depth;
+	}
+}
+
+//reverse cuthill-mckee: breadth first from a pseudo peripheral vertex of each component, neighbours taken in
+//increasing degree, and the whole order reversed. keeps every row's entries close to the diagonal
+reorder_t reorder_rcm(const reorder_graph_t* g) {
+	unsigned n = g->n;
+	reorder_t p = reorder_new(n);
+
+	unsigned* part = heap(sizeof(unsigned)*(n ? n : 1)); //0 until ordered
+	unsigned* level = heap(sizeof(unsigned)*(n ? n : 1));
+	unsigned* order = heap(sizeof(unsigned)*(n ? n : 1));
+	memset(part, 0, sizeof(unsigned)*n);
+	memset(level, 0xff, sizeof(unsigned)*n);
+
+	unsigned tail = 0;
+	for (unsigned s=0; s<n; s++) {
+		if (part[s]) continue;
+
+		unsigned cnt, depth;
+		unsigned root = reorder_peripheral(g, part, 0, s, order, level, &cnt, &depth);
+		reorder_unlevel(order, cnt, level);
+
+		unsigned head = tail;
+		p.perm[tail++] = root;
+		part[root] = 1;
+
+		while (head < tail) {
+			unsigned v = p.perm[head++], first = tail;
+			for (unsigned i=g->ptr[v]; i<g->ptr[v+1]; i++) {
+				unsigned u = g->adj[i];
+				if (part[u]) continue;
+
+				part[u] = 1;
+				p.perm[tail++] = u;
+			}
+
+			//a handful of neighbours, insertion sort by degree
+			for (unsigned i=first+1; i<tail; i++) {
+				unsigned u = p.perm[i], deg = g->ptr[u+1] - g->ptr[u];
+				unsigned j = i;
+				for (; j>first && g->ptr[p.perm[j-1]+1] - g->ptr[p.perm[j-1]] > deg; j--) p.perm[j] = p.perm[j-1];
+				p.perm[j] = u;
+			}
+		}
+	}
+
+	for (unsigned i=0; i<n/2; i++) {
+		unsigned t = p.perm[i];
+		p.perm[i] = p.perm[n-1-i];
+		p.perm[n-1-i] = t;
+	}
+
+	reorder_invert(&p);
+
+	drop(part);
+	drop(level);
+	drop(order);
+	return p;
+}
+
+typedef struct {
+	unsigned begin, cnt, id;
+} reorder_nd_task_t;
+
+//nested dissection: split each subgraph at a middle level of its level structure, order both halves
+//recursively and the separator after them, so elimination of one half never fills into the other
+//perm doubles as the working array, each task owns perm[begin..begin+cnt) and rearranges it in place
+reorder_t reorder_nd(const reorder_graph_t* g) {
+	unsigned n = g->n;
+	reorder_t p = reorder_new(n);
+
+	unsigned* part = heap(sizeof(unsigned)*(n ? n : 1)); //subgraph id, -1 once placed in a separator
+	unsigned* level = heap(sizeof(unsigned)*(n ? n : 1));
+	unsigned* order = heap(sizeof(unsigned)*(n ? n : 1));
+	unsigned* count = heap(sizeof(unsigned)*(n+1));
+	memset(part, 0, sizeof(unsigned)*n);
+	memset(level, 0xff, sizeof(unsigned)*n);
+	for (unsigned i=0; i<n; i++) p.perm[i] = i;
+
+	//explicit stack, a star peels one component at a time and would recurse n deep
+	vector_t tasks = vector_new(sizeof(reorder_nd_task_t));
+	vector_pushcpy(&tasks, &(reorder_nd_task_t){.begin=0, .cnt=n, .id=0});
+	unsigned next_id = 1;
+
+	while (tasks.length) {
+		reorder_nd_task_t task = *(reorder_nd_task_t*)vector_get(&tasks, tasks.length-1);
+		tasks.length--;
+		if (task.cnt <= REORDER_LEAF) continue;
+
+		unsigned* verts = p.perm + task.begin;
+		unsigned reached, depth;
+		reorder_peripheral(g, part, task.id, verts[0], order, level, &reached, &depth);
+
+		unsigned sep_level = (unsigned)-1;
+		if (reached == task.cnt) {
+			if (depth < 3) {
+				reorder_unlevel(order, reached, level);
+				continue;
+			}
+
+			//first level where the levels before it hold half the vertices, kept off either end
+			memset(count, 0, sizeof(unsigned)*depth);
+			for (unsigned i=0; i<reached; i++) count[level[order[i]]]++;
+
+			unsigned below = 0;
+			for (sep_level=1; sep_level<depth-2; sep_level++) {
+				below += count[sep_level-1];
+				if (2*(below + count[sep_level]) >= task.cnt) break;
+			}
+		}
+
+		//disconnected subgraphs split into the reached component and the rest, with nothing between them
+		unsigned ids[3] = {next_id, next_id+1, (unsigned)-1};
+		next_id += 2;
+
+		//class per vertex into order, the bfs order is done with: 0 first half, 1 second half, 2 separator
+		unsigned sizes[3] = {0};
+		for (unsigned i=0; i<task.cnt; i++) {
+			unsigned v = verts[i], l = level[v], cls;
+			if (l == (unsigned)-1) cls = 1;
+			else if (sep_level == (unsigned)-1 || l < sep_level) cls = 0;
+			else if (l > sep_level) cls = 1;
+			else {
+				//separator vertices with no neighbour further out only touch the first half, move them there
+				cls = 0;
+				for (unsigned k=g->ptr[v]; k<g->ptr[v+1]; k++) {
+					unsigned u = g->adj[k];
+					if (part[u] == task.id && level[u] == l+1) cls = 2;
+				}
+			}
+
+			order[i] = cls;
+			sizes[cls]++;
+		}
+
+		//stable partition through count, levels are cleared on the way back
+		unsigned at[3] = {0, sizes[0], sizes[0] + sizes[1]};
+		unsigned* scratch = count;
+		for (unsigned i=0; i<task.cnt; i++) scratch[at[order[i]]++] = verts[i];
+
+		for (unsigned i=0; i<task.cnt; i++) {
+			unsigned v = scratch[i];
+			verts[i] = v;
+			level[v] = (unsigned)-1;
+		}
+
+		for (unsigned i=0; i<task.cnt; i++) {
+			unsigned cls = i < sizes[0] ? 0 : i < sizes[0] + sizes[1] ? 1 : 2;
+			part[verts[i]] = ids[cls];
+		}
+
+		vector_pushcpy(&tasks, &(reorder_nd_task_t){.begin=task.begin, .cnt=sizes[0], .id=ids[0]});
+		vector_pushcpy(&tasks, &(reorder_nd_task_t){.begin=task.begin + sizes[0], .cnt=sizes[1], .id=ids[1]});
+	}
+
+	reorder_invert(&p);
+
+	vector_free(&tasks);
+	drop(part);
+	drop(level);
+	drop(order);
+	drop(count);
+	return p;
+}
+
+//b = P a P^T: row i of b is row perm[i] of a, columns renumbered through iperm and sorted again
+csr_t reorder_csr(const csr_t* a, const reorder_t* p) {
+	csr_t b = {.nrows=a->nrows, .ncols=a->ncols, .nnz=a->nnz};
+	b.row_ptr = heap(sizeof(unsigned)*(a->nrows+1));
+	b.col = heap(sizeof(unsigned)*(a->nnz ? a->nnz : 1));
+	b.val = heap(sizeof(double)*(a->nnz ? a->nnz : 1));
+
+	b.row_ptr[0] = 0;
+	for (unsigned r=0; r<b.nrows; r++) {
+		unsigned src = p->perm[r], begin = b.row_ptr[r];
+		unsigned end = begin + a->row_ptr[src+1] - a->row_ptr[src];
+		b.row_ptr[r+1] = end;
+
+		for (unsigned i=begin, j=a->row_ptr[src]; i<end; i++, j++) {
+			unsigned c = p->iperm[a->col[j]];
+			double v = a->val[j];
+
+			unsigned k = i;
+			for (; k>begin && b.col[k-1] > c; k--) {
+				b.col[k] = b.col[k-1];
+				b.val[k] = b.val[k-1];
+			}
+
+			b.col[k] = c;
+			b.val[k] = v;
+		}
+	}
+
+	return b;
+}
+
+//relabels the triplets in place so the next freeze comes out permuted, and rebuilds the lookup on the new keys
+void reorder_sparsemat(sparsemat_t* m, const reorder_t* p) {
+	map_free(&m->rows);
+	m->rows = map_new();
+	map_configure_uint64_key(&m->rows, sizeof(unsigned));
+
+	for (unsigned i=0; i<m->elems.length; i++) {
+		sparsemat_elem_t* e = vector_get(&m->elems, i);
+		e->row = p->iperm[e->row];
+		e->col = p->iperm[e->col];
+
+		uint64_t key = (uint64_t)e->row<<32 | e->col;
+		map_insertcpy_noexist(&m->rows, &key, &i);
+	}
+}
+
+//out = P x, a vector in the original numbering into the permuted one. x and out may not alias
+void reorder_gather(const reorder_t* p, const double* x, double* out) {
+	for (unsigned i=0; i<p->n; i++) out[i] = x[p->perm[i]];
+}
+
+//out = P^T x, a solution of the permuted system back to the original numbering
+void reorder_scatter(const reorder_t* p, const double* x, double* out) {
+	for (unsigned i=0; i<p->n; i++) out[p->perm[i]] = x[i];
+}
+
+//largest |row - col| over the stored entries
+unsigned reorder_bandwidth(const csr_t* a) {
+	unsigned bw = 0;
+	for (unsigned r=0; r<a->nrows; r++) {
+		if (a->row_ptr[r] == a->row_ptr[r+1]) continue;
+
+		unsigned lo = a->col[a->row_ptr[r]], hi = a->col[a->row_ptr[r+1]-1];
+		if (lo < r && r - lo > bw) bw = r - lo;
+		if (hi > r && hi - r > bw) bw = hi - r;
+	}
+
+	return bw;
+}
+
+//sum over rows of the distance from the first entry to the diagonal, what a skyline factor would store
+unsigned long long reorder_profile(const csr_t* a) {
+	unsigned long long prof = 0;
+	for (unsigned r=0; r<a->nrows; r++) {
+		if (a->row_ptr[r] == a->row_ptr[r+1]) continue;
+
+		unsigned lo = a->col[a->row_ptr[r]];
+		if (lo < r) prof += r - lo;
+	}
+
+	return prof;
+}
+
+void reorder_free(reorder_t* p) {
+	drop(p->perm);
+	drop(p->iperm);
+}
@@ -0,0 +1,110 @@
+#include <complex.h>
+#include <string.h>
+
+#include "util.h"
+#include "fft.h"
+#include "fft_simd.h"
+
+//real transforms of length n with n/2+1 hermitian bins
+//even n packs pairs of reals into one complex transform of n/2, odd n goes through a full complex plan
+typedef struct {
+	unsigned n;
+	fft_plan_t cplan;
+
+	complex float* tw; //e^(-2 pi i k/n), k <= n/4
+	complex float* scratch; //odd n only
+} fft_rplan_t;
+
+fft_rplan_t fft_rplan(unsigned n) {
+	fft_rplan_t plan = {.n=n};
+	if (n == 0) return plan;
+
+	if (n % 2) {
+		plan.cplan = fft_plan(n);
+		plan.scratch = heap(sizeof(complex float)*n);
+		return plan;
+	}
+
+	plan.cplan = fft_plan(n/2);
+	plan.tw = heap(sizeof(complex float)*(n/4 + 1));
+	fft_twiddle_t roots = fft_coeffs(n);
+	for (unsigned k=0; k<=n/4; k++) plan.tw[k] = roots.w[k*roots.stride];
+
+	return plan;
+}
+
+//out holds n/2+1 bins, the rest of the spectrum is their conjugate mirror
+void fft_r2c(fft_rplan_t* plan, const float* in, complex float* out) {
+	unsigned n = plan->n;
+	if (n == 0) return;
+
+	if (n % 2) {
+		for (unsigned j=0; j<n; j++) plan->scratch[j] = in[j];
+		fft_exec(&plan->cplan, plan->scratch, fft_forward);
+		memcpy(out, plan->scratch, sizeof(complex float)*(n/2 + 1));
+		return;
+	}
+
+	//even/odd samples as real/imaginary parts
+	unsigned h = n/2;
+	memcpy(out, in, sizeof(float)*n);
+	fft_exec(&plan->cplan, out, fft_forward);
+
+	complex float z0 = out[0];
+	out[0] = crealf(z0) + cimagf(z0);
+	out[h] = crealf(z0) - cimagf(z0);
+
+	//untangle bins k and h-k together: X[k] = E + w^k O, X[h-k] = conj(E - w^k O)
+	for (unsigned k=1; k<=h/2; k++) {
+		complex float zk = out[k], zr = conjf(out[h-k]);
+		complex float e = 0.5f*(zk + zr);
+		complex float d = 0.5f*(zk - zr);
+		complex float wo = FFT_CMULF(CMPLXF(cimagf(d), -crealf(d)), plan->tw[k]);
+
+		out[k] = e + wo;
+		out[h-k] = conjf(e - wo);
+	}
+}
+
+//in holds n/2+1 bins and is left untouched. unnormalized, c2r(r2c(x)) = n*x
+void fft_c2r(fft_rplan_t* plan, const complex float* in, float* out) {
+	unsigned n = plan->n;
+	if (n == 0) return;
+
+	if (n % 2) {
+		plan->scratch[0] = in[0];
+		for (unsigned k=1; k<=n/2; k++) {
+			plan->scratch[k] = in[k];
+			plan->scratch[n-k] = conjf(in[k]);
+		}
+
+		fft_exec(&plan->cplan, plan->scratch, fft_inverse);
+		for (unsigned j=0; j<n; j++) out[j] = crealf(plan->scratch[j]);
+		return;
+	}
+
+	//retangle into the half length spectrum, the factor 2 is what makes the result n*x
+	unsigned h = n/2;
+	complex float* z = (complex float*)out;
+
+	float x0 = crealf(in[0]), xh = crealf(in[h]);
+	z[0] = CMPLXF(x0 + xh, x0 - xh);
+
+	for (unsigned k=1; k<=h/2; k++) {
+		complex float xk = in[k], xr = conjf(in[h-k]);
+		complex float e = xk + xr;
+		complex float o = FFT_CMULF(xk - xr, conjf(plan->tw[k]));
+		complex float io = CMPLXF(-cimagf(o), crealf(o));
+
+		z[k] = e + io;
+		z[h-k] = conjf(e - io);
+	}
+
+	fft_exec(&plan->cplan, z, fft_inverse);
+}
+
+void fft_rplan_free(fft_rplan_t* plan) {
+	fft_plan_free(&plan->cplan);
+	drop(plan->tw);
+	drop(plan->scratch);
+}
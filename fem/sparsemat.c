@@ -1,9 +1,255 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "util.h"
 #include "vector.h"
 #include "hashtable.h"
 
 typedef struct {
-	vector_t elems;
-	map_t rows;
+	unsigned row, col;
+	double v;
+} sparsemat_elem_t;
+
+//assembly side: unordered triplets, rows maps (row, col) to the triplet so repeated adds sum in place
+typedef struct {
+	unsigned nrows, ncols;
+	vector_t elems; //sparsemat_elem_t
+	map_t rows; //row<<32 | col -> index into elems
 } sparsemat_t;
 
-//conjugate gradient / gmres, todo
+//frozen compressed sparse row, columns sorted and unique within each row
+//the same layout read column wise is csc, see csr_transpose
+typedef struct {
+	unsigned nrows, ncols;
+	unsigned nnz;
+
+	unsigned* row_ptr; //nrows+1, row i is [row_ptr[i], row_ptr[i+1])
+	unsigned* col;
+	double* val;
+} csr_t;
+
+sparsemat_t sparsemat_new(unsigned nrows, unsigned ncols) {
+	sparsemat_t m = {.nrows=nrows, .ncols=ncols};
+	m.elems = vector_new(sizeof(sparsemat_elem_t));
+	m.rows = map_new();
+	map_configure_uint64_key(&m.rows, sizeof(unsigned));
+	return m;
+}
+
+//a += v, summing with whatever was added at (row, col) before
+void sparsemat_add(sparsemat_t* m, unsigned row, unsigned col, double v) {
+	uint64_t key = (uint64_t)row<<32 | col;
+	map_insert_result res = map_insertcpy_noexist(&m->rows, &key, &m->elems.length);
+
+	if (res.exists) {
+		((sparsemat_elem_t*)vector_get(&m->elems, *(unsigned*)res.val))->v += v;
+	} else {
+		vector_pushcpy(&m->elems, &(sparsemat_elem_t){.row=row, .col=col, .v=v});
+	}
+}
+
+//appends without the lookup, duplicates are summed when freezing. for bulk assembly that never reads back
+void sparsemat_push(sparsemat_t* m, unsigned row, unsigned col, double v) {
+	vector_pushcpy(&m->elems, &(sparsemat_elem_t){.row=row, .col=col, .v=v});
+}
+
+//empties for the next assembly, the triplet storage is kept
+void sparsemat_clear(sparsemat_t* m) {
+	vector_clear(&m->elems);
+	map_free(&m->rows);
+	m->rows = map_new();
+	map_configure_uint64_key(&m->rows, sizeof(unsigned));
+}
+
+//bucket by row, sort each row by column, then sum duplicates and compact. the builder is left as is
+csr_t sparsemat_freeze(sparsemat_t* m) {
+	csr_t a = {.nrows=m->nrows, .ncols=m->ncols};
+	unsigned n = m->elems.length;
+
+	a.row_ptr = heap(sizeof(unsigned)*(a.nrows+1));
+	memset(a.row_ptr, 0, sizeof(unsigned)*(a.nrows+1));
+
+	for (unsigned i=0; i<n; i++) {
+		sparsemat_elem_t* e = vector_get(&m->elems, i);
+		a.row_ptr[e->row+1]++;
+	}
+
+	for (unsigned r=0; r<a.nrows; r++) a.row_ptr[r+1] += a.row_ptr[r];
+
+	unsigned* fill = heapcpy(sizeof(unsigned)*a.nrows, a.row_ptr);
+	unsigned* col = heap(sizeof(unsigned)*(n ? n : 1));
+	double* val = heap(sizeof(double)*(n ? n : 1));
+
+	for (unsigned i=0; i<n; i++) {
+		sparsemat_elem_t* e = vector_get(&m->elems, i);
+		unsigned at = fill[e->row]++;
+		col[at] = e->col;
+		val[at] = e->v;
+	}
+
+	drop(fill);
+
+	//fem rows hold a few dozen entries, insertion sort beats anything fancier there
+	unsigned out = 0;
+	for (unsigned r=0; r<a.nrows; r++) {
+		unsigned begin = a.row_ptr[r], end = a.row_ptr[r+1];
+
+		for (unsigned i=begin+1; i<end; i++) {
+			unsigned c = col[i];
+			double v = val[i];
+
+			unsigned j = i;
+			for (; j>begin && col[j-1] > c; j--) {
+				col[j] = col[j-1];
+				val[j] = val[j-1];
+			}
+
+			col[j] = c;
+			val[j] = v;
+		}
+
+		a.row_ptr[r] = out;
+		for (unsigned i=begin; i<end; i++) {
+			if (out > a.row_ptr[r] && col[out-1] == col[i]) {
+				val[out-1] += val[i];
+			} else {
+				col[out] = col[i];
+				val[out] = val[i];
+				out++;
+			}
+		}
+	}
+
+	a.row_ptr[a.nrows] = out;
+	a.nnz = out;
+	a.col = resize(col, sizeof(unsigned)*(out ? out : 1));
+	a.val = resize(val, sizeof(double)*(out ? out : 1));
+
+	return a;
+}
+
+void sparsemat_free(sparsemat_t* m) {
+	vector_free(&m->elems);
+	map_free(&m->rows);
+}
+
+//y = A x
+void csr_spmv(const csr_t* a, const double* x, double* y) {
+	for (unsigned r=0; r<a->nrows; r++) {
+		double sum = 0;
+		for (unsigned i=a->row_ptr[r]; i<a->row_ptr[r+1]; i++) sum += a->val[i]*x[a->col[i]];
+		y[r] = sum;
+	}
+}
+
+//A^T, which doubles as the csc form of A. columns come out sorted since rows are walked in order
+csr_t csr_transpose(const csr_t* a) {
+	csr_t t = {.nrows=a->ncols, .ncols=a->nrows, .nnz=a->nnz};
+	t.row_ptr = heap(sizeof(unsigned)*(t.nrows+1));
+	memset(t.row_ptr, 0, sizeof(unsigned)*(t.nrows+1));
+	t.col = heap(sizeof(unsigned)*(a->nnz ? a->nnz : 1));
+	t.val = heap(sizeof(double)*(a->nnz ? a->nnz : 1));
+
+	for (unsigned i=0; i<a->nnz; i++) t.row_ptr[a->col[i]+1]++;
+	for (unsigned r=0; r<t.nrows; r++) t.row_ptr[r+1] += t.row_ptr[r];
+
+	unsigned* fill = heapcpy(sizeof(unsigned)*t.nrows, t.row_ptr);
+	for (unsigned r=0; r<a->nrows; r++) {
+		for (unsigned i=a->row_ptr[r]; i<a->row_ptr[r+1]; i++) {
+			unsigned at = fill[a->col[i]]++;
+			t.col[at] = r;
+			t.val[at] = a->val[i];
+		}
+	}
+
+	drop(fill);
+	return t;
+}
+
+//c = a b, gustavson's row by row product: a counting pass, then rows accumulated through a dense column map
+csr_t csr_matmul(const csr_t* a, const csr_t* b) {
+	csr_t c = {.nrows=a->nrows, .ncols=b->ncols};
+	c.row_ptr = heap(sizeof(unsigned)*(c.nrows+1));
+
+	unsigned* pos = heap(sizeof(unsigned)*(b->ncols ? b->ncols : 1));
+	memset(pos, 0xff, sizeof(unsigned)*b->ncols);
+
+	c.row_ptr[0] = 0;
+	for (unsigned r=0; r<a->nrows; r++) {
+		unsigned cnt = 0;
+		for (unsigned i=a->row_ptr[r]; i<a->row_ptr[r+1]; i++) {
+			unsigned k = a->col[i];
+			for (unsigned j=b->row_ptr[k]; j<b->row_ptr[k+1]; j++) {
+				if (pos[b->col[j]] != r) {
+					pos[b->col[j]] = r;
+					cnt++;
+				}
+			}
+		}
+
+		c.row_ptr[r+1] = c.row_ptr[r] + cnt;
+	}
+
+	c.nnz = c.row_ptr[c.nrows];
+	c.col = heap(sizeof(unsigned)*(c.nnz ? c.nnz : 1));
+	c.val = heap(sizeof(double)*(c.nnz ? c.nnz : 1));
+	memset(pos, 0xff, sizeof(unsigned)*b->ncols);
+
+	for (unsigned r=0; r<a->nrows; r++) {
+		unsigned begin = c.row_ptr[r], end = begin;
+		for (unsigned i=a->row_ptr[r]; i<a->row_ptr[r+1]; i++) {
+			unsigned k = a->col[i];
+			for (unsigned j=b->row_ptr[k]; j<b->row_ptr[k+1]; j++) {
+				unsigned cc = b->col[j];
+				if (pos[cc] == (unsigned)-1 || pos[cc] < begin) {
+					pos[cc] = end;
+					c.col[end] = cc;
+					c.val[end++] = a->val[i]*b->val[j];
+				} else {
+					c.val[pos[cc]] += a->val[i]*b->val[j];
+				}
+			}
+		}
+
+		for (unsigned i=begin+1; i<end; i++) {
+			unsigned cc = c.col[i];
+			double v = c.val[i];
+
+			unsigned j = i;
+			for (; j>begin && c.col[j-1] > cc; j--) {
+				c.col[j] = c.col[j-1];
+				c.val[j] = c.val[j-1];
+			}
+
+			c.col[j] = cc;
+			c.val[j] = v;
+		}
+	}
+
+	drop(pos);
+	return c;
+}
+
+//position of each row's diagonal entry in a, null if some row has none
+unsigned* csr_diag(const csr_t* a) {
+	unsigned* diag = heap(sizeof(unsigned)*(a->nrows ? a->nrows : 1));
+	for (unsigned r=0; r<a->nrows; r++) {
+		diag[r] = (unsigned)-1;
+		for (unsigned i=a->row_ptr[r]; i<a->row_ptr[r+1]; i++) {
+			if (a->col[i] == r) diag[r] = i;
+		}
+
+		if (diag[r] == (unsigned)-1) {
+			drop(diag);
+			return NULL;
+		}
+	}
+
+	return diag;
+}
+
+void csr_free(csr_t* a) {
+	drop(a->row_ptr);
+	drop(a->col);
+	drop(a->val);
+}
@@ -0,0 +1,278 @@
+#include <field.h>
+#include <complex.h>
+#include <math.h>
+#include <string.h>
+
+#include "util.h"
+#include "fft.h"
+#include "fft3.h"
+#include "pool.h"
+
+//lines per thomas work item, their forward sweep factors stay in l1/l2 while the planes stream past
+#define SPECTRAL_LINES 64
+
+//periodic solver for (laplacian - lambda) u = f on a nx*ny*nz grid with spacing h, stored x fastest
+//plan, wave numbers and the grid are kept so a time loop only pays for the two transforms
+typedef struct {
+	unsigned nx, ny, nz;
+	fft3_plan_t plan;
+	pool_t* pool;
+
+	double* k2[3]; //squared wave number per axis index, k = 2 pi m/(n h) with m wrapped to [-n/2, n/2)
+	complex double* grid;
+} spectral_t;
+
+static double* spectral_k2(unsigned n, double h) {
+	double* k2 = heap(sizeof(double)*n);
+	for (unsigned i=0; i<n; i++) {
+		double m = i < (n+1)/2 ? (double)i : (double)i - (double)n;
+		double k = 2.0*M_PI*m/((double)n*h);
+		k2[i] = k*k;
+	}
+
+	return k2;
+}
+
+spectral_t spectral_new(unsigned nx, unsigned ny, unsigned nz, double h, pool_t* pool) {
+	spectral_t s = {.nx=nx, .ny=ny, .nz=nz, .pool=pool};
+	s.plan = fft3_plan(nx, ny, nz, fft_f64, pool);
+
+	s.k2[0] = spectral_k2(nx, h);
+	s.k2[1] = spectral_k2(ny, h);
+	s.k2[2] = spectral_k2(nz, h);
+	s.grid = heap(sizeof(complex double)*nx*ny*nz);
+
+	return s;
+}
+
+typedef struct {
+	spectral_t* s;
+	double lambda;
+} spectral_divide_t;
+
+//u^ = -f^/(k^2 + lambda), with the 1/n of the inverse transform folded in. work items are z planes
+static void spectral_divide(void* arg, unsigned worker, unsigned begin, unsigned end) {
+	spectral_divide_t* job = arg;
+	spectral_t* s = job->s;
+	double scale = -1.0/((double)s->nx*s->ny*s->nz);
+
+	for (unsigned z=begin; z<end; z++) {
+		for (unsigned y=0; y<s->ny; y++) {
+			complex double* row = s->grid + ((size_t)z*s->ny + y)*s->nx;
+			double kyz = s->k2[1][y] + s->k2[2][z] + job->lambda;
+
+			for (unsigned x=0; x<s->nx; x++) {
+				double d = s->k2[0][x] + kyz;
+				//the mean is undetermined for poisson, pin it to zero (a source with nonzero mean has no periodic solution)
+				row[x] = d == 0 ? 0 : row[x]*(scale/d);
+			}
+		}
+	}
+}
+
+//solves on s->grid, which holds the forward transform of the source on entry and u on return
+static void spectral_solve(spectral_t* s, double lambda) {
+	spectral_divide_t job = {.s=s, .lambda=lambda};
+	pool_run(s->pool, spectral_divide, &job, s->nz, pool_grain(s->pool, s->nz));
+	fft3_exec(&s->plan, s->grid, fft_inverse);
+}
+
+//lambda >= 0, 0 being poisson. f and u may alias
+void spectral_helmholtz(spectral_t* s, const double* f, double* u, double lambda) {
+	size_t n = (size_t)s->nx*s->ny*s->nz;
+	for (size_t i=0; i<n; i++) s->grid[i] = f[i];
+
+	fft3_exec(&s->plan, s->grid, fft_forward);
+	spectral_solve(s, lambda);
+
+	for (size_t i=0; i<n; i++) u[i] = creal(s->grid[i]);
+}
+
+void spectral_poisson(spectral_t* s, const double* f, double* u) {
+	spectral_helmholtz(s, f, u, 0);
+}
+
+//solves in place on one component of a field, s has to be d*d*d for an axis of length d
+void spectral_field(spectral_t* s, axis_t* base, unsigned char part, double lambda) {
+	fft_field(base, part, &s->plan, s->grid, fft_forward);
+	spectral_solve(s, lambda);
+
+	unsigned d = axis_length(base);
+	axis_iter_t iter = axis_iter(base);
+	while (axis_next(&iter)) {
+		iter.x[part] = creal(s->grid[((size_t)iter.indices[2]*d + iter.indices[1])*d + iter.indices[0]]);
+	}
+}
+
+void spectral_free(spectral_t* s) {
+	fft3_plan_free(&s->plan);
+	for (unsigned i=0; i<3; i++) drop(s->k2[i]);
+	drop(s->grid);
+}
+
+typedef enum {
+	spectral_dirichlet, //u = 0 one spacing past either end of z
+	spectral_neumann //du/dz = 0 at both ends
+} spectral_bc;
+
+//periodic in x and y, walls on z. each z plane is transformed in 2d, every (kx, ky) mode then leaves a
+//second order tridiagonal system down z, solved with thomas over blocks of lines at once
+//memory is the grid plus a plane per thread, where spectral_t needs two full grids
+typedef struct {
+	unsigned nx, ny, nz;
+	double h;
+	spectral_bc bc;
+	pool_t* pool;
+
+	fft_plan_t px, py;
+	double* kxy; //kx^2 + ky^2 in transformed plane order, x major
+	complex double* grid; //z planes of nx*ny, y fastest once transformed
+
+	char* work; //per worker: transposed plane, fft scratch, forward sweep factors
+	size_t work_size;
+	size_t sweep_at; //offset of the sweep factors in a worker's block
+} spectral_lines_t;
+
+spectral_lines_t spectral_lines_new(unsigned nx, unsigned ny, unsigned nz, double h, spectral_bc bc, pool_t* pool) {
+	spectral_lines_t s = {.nx=nx, .ny=ny, .nz=nz, .h=h, .bc=bc, .pool=pool};
+	s.px = fft_plan_prec(nx, fft_f64);
+	s.py = fft_plan_prec(ny, fft_f64);
+
+	double* k2x = spectral_k2(nx, h);
+	double* k2y = spectral_k2(ny, h);
+	s.kxy = heap(sizeof(double)*nx*ny);
+	for (unsigned x=0; x<nx; x++) {
+		for (unsigned y=0; y<ny; y++) s.kxy[x*ny + y] = k2x[x] + k2y[y];
+	}
+
+	drop(k2x);
+	drop(k2y);
+
+	s.grid = heap(sizeof(complex double)*nx*ny*nz);
+
+	unsigned fft_scratch = s.px.scratch_len > s.py.scratch_len ? s.px.scratch_len : s.py.scratch_len;
+	s.sweep_at = sizeof(complex double)*((size_t)nx*ny + fft_scratch);
+	s.work_size = s.sweep_at + sizeof(double)*nz*SPECTRAL_LINES;
+	s.work = heap(s.work_size*pool_threads(pool));
+
+	return s;
+}
+
+typedef struct {
+	spectral_lines_t* s;
+	fft_dir dir;
+} spectral_planes_t;
+
+//b = a^T for a rows*cols plane
+static void spectral_transpose(const complex double* a, complex double* b, unsigned rows, unsigned cols) {
+	for (unsigned i=0; i<rows; i++) {
+		for (unsigned j=0; j<cols; j++) b[(size_t)j*rows + i] = a[(size_t)i*cols + j];
+	}
+}
+
+//2d transform of each z plane. forward leaves the plane transposed (y fastest), inverse expects and undoes that
+static void spectral_planes(void* arg, unsigned worker, unsigned begin, unsigned end) {
+	spectral_planes_t* job = arg;
+	spectral_lines_t* s = job->s;
+	unsigned nx = s->nx, ny = s->ny;
+
+	complex double* t = (complex double*)(s->work + worker*s->work_size);
+	complex double* fs = t + (size_t)nx*ny;
+
+	//forward: x lines, transpose, y lines. inverse: y lines, transpose back, x lines
+	fft_plan_t* first = job->dir == fft_forward ? &s->px : &s->py;
+	fft_plan_t* second = job->dir == fft_forward ? &s->py : &s->px;
+	unsigned n1 = first->n, n2 = second->n;
+
+	for (unsigned z=begin; z<end; z++) {
+		complex double* p = s->grid + (size_t)z*nx*ny;
+
+		for (unsigned l=0; l<n2; l++) fft_exec_scratch(first, p + (size_t)l*n1, job->dir, fs);
+		spectral_transpose(p, t, n2, n1);
+		for (unsigned l=0; l<n1; l++) fft_exec_scratch(second, t + (size_t)l*n2, job->dir, fs);
+
+		memcpy(p, t, sizeof(complex double)*nx*ny);
+	}
+}
+
+typedef struct {
+	spectral_lines_t* s;
+	double lambda;
+} spectral_thomas_t;
+
+//(u[z-1] - 2u[z] + u[z+1])/h^2 - (kx^2 + ky^2 + lambda) u[z] = f[z] down every line of a block
+//the inner loops run across the lines of a block, which sit next to each other in every plane
+static void spectral_thomas(void* arg, unsigned worker, unsigned begin, unsigned end) {
+	spectral_thomas_t* job = arg;
+	spectral_lines_t* s = job->s;
+	unsigned lines = s->nx*s->ny, nz = s->nz;
+
+	double* cp = (double*)(s->work + worker*s->work_size + s->sweep_at);
+	double ih2 = 1.0/(s->h*s->h);
+	double scale = 1.0/(double)lines; //inverse 2d transform
+	double wall = s->bc == spectral_neumann ? ih2 : 0; //mirrored ghost cancels one off diagonal
+
+	for (unsigned blk=begin; blk<end; blk++) {
+		unsigned l0 = blk*SPECTRAL_LINES;
+		unsigned nl = l0 + SPECTRAL_LINES < lines ? SPECTRAL_LINES : lines - l0;
+		const double* k = s->kxy + l0;
+
+		complex double* g = s->grid + l0;
+		double edge = wall + (nz == 1 ? wall : 0);
+		for (unsigned l=0; l<nl; l++) {
+			double piv = -2.0*ih2 + edge - k[l] - job->lambda;
+			cp[l] = ih2/piv;
+			g[l] = piv == 0 ? 0 : scale*g[l]/piv;
+		}
+
+		for (unsigned z=1; z<nz; z++) {
+			const complex double* gp = g;
+			const double* cprev = cp + (size_t)(z-1)*SPECTRAL_LINES;
+			double* c = cp + (size_t)z*SPECTRAL_LINES;
+
+			g += lines;
+			edge = z == nz-1 ? wall : 0;
+
+			for (unsigned l=0; l<nl; l++) {
+				double piv = -2.0*ih2 + edge - k[l] - job->lambda - ih2*cprev[l];
+				c[l] = ih2/piv;
+				//only the neumann mean mode is singular, its free constant is pinned at the last plane
+				g[l] = piv == 0 ? 0 : (scale*g[l] - ih2*gp[l])/piv;
+			}
+		}
+
+		for (unsigned z=nz-1; z-- > 0;) {
+			complex double* g = s->grid + (size_t)z*lines + l0;
+			const complex double* gn = g + lines;
+			const double* c = cp + (size_t)z*SPECTRAL_LINES;
+
+			for (unsigned l=0; l<nl; l++) g[l] -= c[l]*gn[l];
+		}
+	}
+}
+
+//lambda >= 0, 0 being poisson. f and u may alias
+void spectral_lines_helmholtz(spectral_lines_t* s, const double* f, double* u, double lambda) {
+	size_t n = (size_t)s->nx*s->ny*s->nz;
+	for (size_t i=0; i<n; i++) s->grid[i] = f[i];
+
+	spectral_planes_t planes = {.s=s, .dir=fft_forward};
+	pool_run(s->pool, spectral_planes, &planes, s->nz, pool_grain(s->pool, s->nz));
+
+	unsigned blocks = (s->nx*s->ny + SPECTRAL_LINES - 1)/SPECTRAL_LINES;
+	spectral_thomas_t thomas = {.s=s, .lambda=lambda};
+	pool_run(s->pool, spectral_thomas, &thomas, blocks, pool_grain(s->pool, blocks));
+
+	planes.dir = fft_inverse;
+	pool_run(s->pool, spectral_planes, &planes, s->nz, pool_grain(s->pool, s->nz));
+
+	for (size_t i=0; i<n; i++) u[i] = creal(s->grid[i]);
+}
+
+void spectral_lines_free(spectral_lines_t* s) {
+	fft_plan_free(&s->px);
+	fft_plan_free(&s->py);
+	drop(s->kxy);
+	drop(s->grid);
+	drop(s->work);
+}
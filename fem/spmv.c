@@ -0,0 +1,288 @@
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SPMV_X86
+#include <immintrin.h>
+#endif
+
+#include "util.h"
+#include "sparsemat.h"
+#include "pool.h"
+#include "cpu.h"
+
+//parts per thread, a few so a thread held up by a page fault does not stall the whole product
+#define SPMV_PARTS 4
+
+//parallel y = A x over a frozen csr, rows split so every part carries the same number of nonzeros
+//fem matrices mix short boundary rows with long interior ones, equal row counts would not balance
+typedef struct {
+	const csr_t* a;
+	pool_t* pool;
+
+	unsigned nparts;
+	unsigned* part; //nparts+1 row boundaries
+	int simd; //avx2 gather rows, on when the cpu has it
+} spmv_t;
+
+//sliced ellpack (sell-c-sigma): rows sorted by length within windows of sigma, then packed c at a time
+//column major inside each slice, so c rows advance in lockstep through one vector register
+typedef struct {
+	unsigned nrows, ncols;
+	unsigned c, sigma;
+	unsigned nslices;
+
+	unsigned* slice_ptr; //nslices+1, offsets into col/val
+	unsigned* slice_len; //width of each slice
+	unsigned* perm; //packed row -> original row
+
+	unsigned* col; //padding points at column 0 with a zero value
+	double* val;
+	unsigned nnz, stored; //stored includes the padding
+	int simd; //avx2 slices, c = 4 only
+} sell_t;
+
+spmv_t spmv_new(const csr_t* a, pool_t* pool) {
+	spmv_t s = {.a=a, .pool=pool, .simd=cpu_has_avx2()};
+	s.nparts = pool_threads(pool)*SPMV_PARTS;
+	if (s.nparts > a->nrows) s.nparts = a->nrows ? a->nrows : 1;
+
+	s.part = heap(sizeof(unsigned)*(s.nparts+1));
+	s.part[0] = 0;
+
+	//first row whose prefix reaches each share of the nonzeros
+	unsigned r = 0;
+	for (unsigned p=1; p<s.nparts; p++) {
+		unsigned long long target = (unsigned long long)a->nnz*p/s.nparts;
+		while (r < a->nrows && a->row_ptr[r] < target) r++;
+		s.part[p] = r;
+	}
+
+	s.part[s.nparts] = a->nrows;
+	return s;
+}
+
+static void spmv_rows_scalar(const csr_t* a, const double* x, double* y, unsigned begin, unsigned end) {
+	for (unsigned r=begin; r<end; r++) {
+		double sum = 0;
+		for (unsigned i=a->row_ptr[r]; i<a->row_ptr[r+1]; i++) sum += a->val[i]*x[a->col[i]];
+		y[r] = sum;
+	}
+}
+
+#ifdef SPMV_X86
+
+//four column indices gather four x entries, two accumulators hide the fma latency on long rows
+__attribute__((target("avx2,fma")))
+static void spmv_rows_avx2(const csr_t* a, const double* x, double* y, unsigned begin, unsigned end) {
+	for (unsigned r=begin; r<end; r++) {
+		unsigned i = a->row_ptr[r], e = a->row_ptr[r+1];
+		__m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+
+		for (; i+8<=e; i+=8) {
+			__m128i c0 = _mm_loadu_si128((const __m128i*)(a->col+i));
+			__m128i c1 = _mm_loadu_si128((const __m128i*)(a->col+i+4));
+			acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(a->val+i), _mm256_i32gather_pd(x, c0, 8), acc0);
+			acc1 = _mm256_fmadd_pd(_mm256_loadu_pd(a->val+i+4), _mm256_i32gather_pd(x, c1, 8), acc1);
+		}
+
+		if (i+4<=e) {
+			__m128i c0 = _mm_loadu_si128((const __m128i*)(a->col+i));
+			acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(a->val+i), _mm256_i32gather_pd(x, c0, 8), acc0);
+			i += 4;
+		}
+
+		acc0 = _mm256_add_pd(acc0, acc1);
+		__m128d h = _mm_add_pd(_mm256_castpd256_pd128(acc0), _mm256_extractf128_pd(acc0, 1));
+		double sum = _mm_cvtsd_f64(_mm_add_sd(h, _mm_unpackhi_pd(h, h)));
+
+		for (; i<e; i++) sum += a->val[i]*x[a->col[i]];
+		y[r] = sum;
+	}
+}
+
+#endif
+
+typedef struct {
+	spmv_t* s;
+	const double* x;
+	double* y;
+} spmv_job_t;
+
+static void spmv_parts(void* arg, unsigned worker, unsigned begin, unsigned end) {
+	spmv_job_t* job = arg;
+	spmv_t* s = job->s;
+
+	for (unsigned p=begin; p<end; p++) {
+#ifdef SPMV_X86
+		if (s->simd) {
+			spmv_rows_avx2(s->a, job->x, job->y, s->part[p], s->part[p+1]);
+			continue;
+		}
+#endif
+		spmv_rows_scalar(s->a, job->x, job->y, s->part[p], s->part[p+1]);
+	}
+}
+
+//y = A x, x and y may not alias
+void spmv_exec(spmv_t* s, const double* x, double* y) {
+	spmv_job_t job = {.s=s, .x=x, .y=y};
+	pool_run(s->pool, spmv_parts, &job, s->nparts, 1);
+}
+
+void spmv_free(spmv_t* s) {
+	drop(s->part);
+}
+
+//the length travels with the row, so the comparator needs no context and construction stays reentrant
+typedef struct {
+	unsigned len, row;
+} sell_row_t;
+
+static int sell_cmp(const void* a, const void* b) {
+	const sell_row_t* ra = a, * rb = b;
+	if (ra->len != rb->len) return ra->len < rb->len ? 1 : -1;
+	return ra->row < rb->row ? -1 : 1;
+}
+
+//c is the slice height up to 64 (4 matches an avx2 register of doubles), sigma the sorting window in rows
+//sigma = 1 keeps the row order, larger windows cut padding at the cost of scattering y
+sell_t sell_from_csr(const csr_t* a, unsigned c, unsigned sigma) {
+	if (c == 0) c = 1;
+	if (c > 64) c = 64;
+
+	sell_t s = {.nrows=a->nrows, .ncols=a->ncols, .c=c, .sigma=sigma ? sigma : 1, .nnz=a->nnz};
+	s.simd = c == 4 && cpu_has_avx2();
+	s.nslices = (a->nrows + c - 1)/c;
+
+	unsigned* len = heap(sizeof(unsigned)*(a->nrows ? a->nrows : 1));
+	sell_row_t* rows = heap(sizeof(sell_row_t)*(a->nrows ? a->nrows : 1));
+	s.perm = heap(sizeof(unsigned)*(s.nslices ? s.nslices*c : 1));
+
+	for (unsigned r=0; r<a->nrows; r++) {
+		len[r] = a->row_ptr[r+1] - a->row_ptr[r];
+		rows[r] = (sell_row_t){len[r], r};
+	}
+
+	for (unsigned w=0; w<a->nrows; w+=s.sigma) {
+		unsigned cnt = w + s.sigma < a->nrows ? s.sigma : a->nrows - w;
+		qsort(rows + w, cnt, sizeof(sell_row_t), sell_cmp);
+	}
+
+	for (unsigned r=0; r<a->nrows; r++) s.perm[r] = rows[r].row;
+	drop(rows);
+
+	//rows past the end pad the last slice
+	for (unsigned r=a->nrows; r<s.nslices*c; r++) s.perm[r] = (unsigned)-1;
+
+	s.slice_ptr = heap(sizeof(unsigned)*(s.nslices+1));
+	s.slice_len = heap(sizeof(unsigned)*(s.nslices ? s.nslices : 1));
+	s.slice_ptr[0] = 0;
+
+	for (unsigned sl=0; sl<s.nslices; sl++) {
+		unsigned w = 0;
+		for (unsigned k=0; k<c; k++) {
+			unsigned r = s.perm[sl*c + k];
+			if (r != (unsigned)-1 && len[r] > w) w = len[r];
+		}
+
+		s.slice_len[sl] = w;
+		s.slice_ptr[sl+1] = s.slice_ptr[sl] + w*c;
+	}
+
+	s.stored = s.slice_ptr[s.nslices];
+	s.col = heap(sizeof(unsigned)*(s.stored ? s.stored : 1));
+	s.val = heap(sizeof(double)*(s.stored ? s.stored : 1));
+
+	for (unsigned sl=0; sl<s.nslices; sl++) {
+		for (unsigned k=0; k<c; k++) {
+			unsigned r = s.perm[sl*c + k];
+			unsigned n = r == (unsigned)-1 ? 0 : len[r];
+
+			for (unsigned j=0; j<s.slice_len[sl]; j++) {
+				unsigned at = s.slice_ptr[sl] + j*c + k;
+				s.col[at] = j < n ? a->col[a->row_ptr[r] + j] : 0;
+				s.val[at] = j < n ? a->val[a->row_ptr[r] + j] : 0;
+			}
+		}
+	}
+
+	drop(len);
+	return s;
+}
+
+typedef struct {
+	const sell_t* s;
+	const double* x;
+	double* y;
+} sell_job_t;
+
+static void sell_slices_scalar(const sell_t* s, const double* x, double* y, unsigned begin, unsigned end) {
+	double sum[64];
+	unsigned c = s->c;
+
+	for (unsigned sl=begin; sl<end; sl++) {
+		memset(sum, 0, sizeof(double)*c);
+		const unsigned* col = s->col + s->slice_ptr[sl];
+		const double* val = s->val + s->slice_ptr[sl];
+
+		for (unsigned j=0; j<s->slice_len[sl]; j++) {
+			for (unsigned k=0; k<c; k++) sum[k] += val[j*c + k]*x[col[j*c + k]];
+		}
+
+		for (unsigned k=0; k<c; k++) {
+			unsigned r = s->perm[sl*c + k];
+			if (r != (unsigned)-1) y[r] = sum[k];
+		}
+	}
+}
+
+#ifdef SPMV_X86
+
+//c = 4: one gather and one fma per column of a slice, no horizontal sums
+__attribute__((target("avx2,fma")))
+static void sell_slices_avx2(const sell_t* s, const double* x, double* y, unsigned begin, unsigned end) {
+	for (unsigned sl=begin; sl<end; sl++) {
+		const unsigned* col = s->col + s->slice_ptr[sl];
+		const double* val = s->val + s->slice_ptr[sl];
+		__m256d acc = _mm256_setzero_pd();
+
+		for (unsigned j=0; j<s->slice_len[sl]; j++) {
+			__m128i c = _mm_loadu_si128((const __m128i*)(col + 4*j));
+			acc = _mm256_fmadd_pd(_mm256_loadu_pd(val + 4*j), _mm256_i32gather_pd(x, c, 8), acc);
+		}
+
+		double sum[4];
+		_mm256_storeu_pd(sum, acc);
+		for (unsigned k=0; k<4; k++) {
+			unsigned r = s->perm[sl*4 + k];
+			if (r != (unsigned)-1) y[r] = sum[k];
+		}
+	}
+}
+
+#endif
+
+static void sell_slices(void* arg, unsigned worker, unsigned begin, unsigned end) {
+	sell_job_t* job = arg;
+#ifdef SPMV_X86
+	if (job->s->simd) {
+		sell_slices_avx2(job->s, job->x, job->y, begin, end);
+		return;
+	}
+#endif
+	sell_slices_scalar(job->s, job->x, job->y, begin, end);
+}
+
+//y = A x over slices split across the pool, x and y may not alias
+void sell_spmv(const sell_t* s, pool_t* pool, const double* x, double* y) {
+	sell_job_t job = {.s=s, .x=x, .y=y};
+	pool_run(pool, sell_slices, &job, s->nslices, pool_grain(pool, s->nslices));
+}
+
+void sell_free(sell_t* s) {
+	drop(s->slice_ptr);
+	drop(s->slice_len);
+	drop(s->perm);
+	drop(s->col);
+	drop(s->val);
+}
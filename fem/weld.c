@@ -0,0 +1,184 @@
+#include <math.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "util.h"
+#include "pool.h"
+
+//merges points that share a position, or an eps sized cell of the position grid. vertex ids follow the first
+//point to land on each, so they come out the same as a serial insert in point order for any thread count
+//points straddling a cell boundary stay apart however close they are, eps is a grid and not a distance
+typedef struct {
+	unsigned count; //points
+	unsigned n; //vertices
+	unsigned* remap; //point -> vertex
+	unsigned* first; //vertex -> first point on it
+} weld_t;
+
+typedef struct {
+	const char* pos;
+	size_t stride;
+	const unsigned* index;
+	unsigned count;
+	double inv_eps; //0 for exact
+
+	atomic_uint_least64_t* table; //hash<<32 | point+1 owning each slot, 0 empty
+	unsigned mask;
+	unsigned* rep; //slot of each point's key, then the first point sharing it
+
+	unsigned nblocks;
+	unsigned* block_off; //vertices before each block
+	weld_t* w;
+} weld_job_t;
+
+static void weld_key(const weld_job_t* job, unsigned i, int64_t key[3]) {
+	const float* p = (const float*)(job->pos + (size_t)(job->index ? job->index[i] : i)*job->stride);
+
+	for (unsigned k=0; k<3; k++) {
+		if (job->inv_eps == 0) {
+			uint32_t bits;
+			memcpy(&bits, &p[k], sizeof(bits));
+			key[k] = bits;
+		} else {
+			key[k] = (int64_t)floor((double)p[k]*job->inv_eps);
+		}
+	}
+}
+
+static unsigned weld_hash(const int64_t key[3]) {
+	uint64_t h = 0x9e3779b97f4a7c15ull;
+	for (unsigned k=0; k<3; k++) {
+		h ^= (uint64_t)key[k];
+		h *= 0xbf58476d1ce4e5b9ull;
+		h ^= h>>31;
+	}
+
+	return (unsigned)(h ^ h>>32);
+}
+
+static int weld_same(const weld_job_t* job, unsigned i, const int64_t key[3]) {
+	int64_t other[3];
+	weld_key(job, i, other);
+	return other[0] == key[0] && other[1] == key[1] && other[2] == key[2];
+}
+
+//open addressing with linear probing. a slot only ever changes from empty to some point, then to lower points
+//with the same key, so after every insert each key's slot holds its lowest point whatever the interleaving
+//the hash rides along in the slot and spares most of the key recomputes on collisions
+static void weld_insert(void* arg, unsigned worker, unsigned begin, unsigned end) {
+	weld_job_t* job = arg;
+
+	for (unsigned i=begin; i<end; i++) {
+		int64_t key[3];
+		weld_key(job, i, key);
+
+		unsigned h = weld_hash(key), slot = h&job->mask;
+		uint64_t mine = (uint64_t)h<<32 | (i+1);
+
+		for (;; slot=(slot+1)&job->mask) {
+			uint64_t cur = atomic_load_explicit(&job->table[slot], memory_order_acquire);
+
+			if (cur == 0) {
+				if (atomic_compare_exchange_strong(&job->table[slot], &cur, mine)) break;
+				//lost the race, cur now holds the winner
+			}
+
+			if (cur>>32 != h || !weld_same(job, (unsigned)cur - 1, key)) continue;
+
+			//same hash bits on top, so the lower point is the lower value
+			while (cur > mine && !atomic_compare_exchange_weak(&job->table[slot], &cur, mine));
+			break;
+		}
+
+		job->rep[i] = slot;
+	}
+}
+
+static void weld_find(void* arg, unsigned worker, unsigned begin, unsigned end) {
+	weld_job_t* job = arg;
+	for (unsigned i=begin; i<end; i++) {
+		job->rep[i] = (unsigned)atomic_load_explicit(&job->table[job->rep[i]], memory_order_relaxed) - 1;
+	}
+}
+
+static void weld_block_range(const weld_job_t* job, unsigned b, unsigned* begin, unsigned* end) {
+	*begin = (unsigned)((uint64_t)job->count*b/job->nblocks);
+	*end = (unsigned)((uint64_t)job->count*(b+1)/job->nblocks);
+}
+
+static void weld_count(void* arg, unsigned worker, unsigned begin, unsigned end) {
+	weld_job_t* job = arg;
+
+	for (unsigned b=begin; b<end; b++) {
+		unsigned lo, hi, cnt = 0;
+		weld_block_range(job, b, &lo, &hi);
+		for (unsigned i=lo; i<hi; i++) cnt += job->rep[i] == i;
+		job->block_off[b+1] = cnt;
+	}
+}
+
+//reps take ids in point order: blocks count theirs, a scan gives each block its first id, then each numbers its own
+static void weld_number(void* arg, unsigned worker, unsigned begin, unsigned end) {
+	weld_job_t* job = arg;
+	weld_t* w = job->w;
+
+	for (unsigned b=begin; b<end; b++) {
+		unsigned lo, hi, id = job->block_off[b];
+		weld_block_range(job, b, &lo, &hi);
+
+		for (unsigned i=lo; i<hi; i++) {
+			if (job->rep[i] != i) continue;
+			w->remap[i] = id;
+			w->first[id++] = i;
+		}
+	}
+}
+
+static void weld_resolve(void* arg, unsigned worker, unsigned begin, unsigned end) {
+	weld_job_t* job = arg;
+	for (unsigned i=begin; i<end; i++) {
+		if (job->rep[i] != i) job->w->remap[i] = job->w->remap[job->rep[i]];
+	}
+}
+
+//point i is the float xyz at pos + (index ? index[i] : i)*stride bytes, eps 0 welds exactly equal bits only
+weld_t weld_new(const void* pos, size_t stride, const unsigned* index, unsigned count, float eps, pool_t* pool) {
+	weld_t w = {.count=count};
+	weld_job_t job = {.pos=pos, .stride=stride, .index=index, .count=count, .inv_eps=eps > 0 ? 1.0/eps : 0, .w=&w};
+
+	unsigned size = 16;
+	while (size < 2*(uint64_t)count) size *= 2;
+	job.mask = size-1;
+	job.table = heap(sizeof(atomic_uint_least64_t)*size);
+	for (unsigned i=0; i<size; i++) atomic_init(&job.table[i], 0);
+
+	job.rep = heap(sizeof(unsigned)*(count ? count : 1));
+	w.remap = heap(sizeof(unsigned)*(count ? count : 1));
+
+	pool_run(pool, weld_insert, &job, count, pool_grain(pool, count));
+	pool_run(pool, weld_find, &job, count, pool_grain(pool, count));
+	drop(job.table);
+
+	//a few blocks per thread. the scan walks them and the corners inside them in order, so the numbering is
+	//first occurrence whatever the block count
+	job.nblocks = pool_threads(pool)*4;
+	job.block_off = heap(sizeof(unsigned)*(job.nblocks+1));
+	job.block_off[0] = 0;
+	pool_run(pool, weld_count, &job, job.nblocks, 1);
+	for (unsigned b=0; b<job.nblocks; b++) job.block_off[b+1] += job.block_off[b];
+
+	w.n = job.block_off[job.nblocks];
+	w.first = heap(sizeof(unsigned)*(w.n ? w.n : 1));
+	pool_run(pool, weld_number, &job, job.nblocks, 1);
+	pool_run(pool, weld_resolve, &job, count, pool_grain(pool, count));
+
+	drop(job.block_off);
+	drop(job.rep);
+	return w;
+}
+
+void weld_free(weld_t* w) {
+	drop(w->remap);
+	drop(w->first);
+}